@@ -10,20 +10,23 @@ class ReLU
 {
     private:
         typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+        typedef Eigen::Ref<Matrix> RefMat;
+        typedef Eigen::Ref<const Matrix> ConstRefMat;
 
     public:
         // A =  max(Z, 0)
-        static inline void activate(const Matrix& Z, Matrix& A)
+        // Принимает также блоки столбцов матриц, что позволяет делить работу между потоками
+        static inline void activate(const ConstRefMat& Z, RefMat A)
         {
             A.array() = Z.array().cwiseMax(Scalar(0));
         }
 
         // J = d_a / d_z = diag(A > 0)
         // G = (A > 0) * F
-        static inline void jacobian(const Matrix& Z, const Matrix& A,
-                                          const Matrix& F, Matrix& G)
+        static inline void jacobian(const ConstRefMat& Z, const ConstRefMat& A,
+                                    const ConstRefMat& F, RefMat G)
         {
-            G.array() = (A.array() > Scalar(0)).select(F, Scalar(0));
+            G.array() = (A.array() > Scalar(0)).select(F.array(), Scalar(0));
         }
 
         static std::string return_type()
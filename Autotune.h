@@ -0,0 +1,188 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include "Network.h"
+#include "Utilities/TuningProfile.h"
+#include "Utilities/Enum.h"
+
+namespace NNE
+{
+namespace internal
+{
+// Время в секундах
+inline double elapsed(const std::chrono::steady_clock::time_point& start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Пробный шаг обучения. В отличие от Network::train_step() не вызывает обратный
+// вызов и телеметрию, не увеличивает счетчик шагов и не усредняет градиенты
+// между процессами: замер в одном процессе не должен требовать шага от остальных.
+inline void tuning_step(Network& net, Optimizer& opt, const Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>& x,
+                        const Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>& y)
+{
+    GradientSync* sync = net._sync;
+    net._sync = NULL;
+
+    try
+    {
+        net.train_batch(opt, x, y);
+    }
+    catch (...)
+    {
+        net._sync = sync;
+        throw;
+    }
+
+    net._sync = sync;
+}
+
+// Возвращает сеть и оптимизатор в исходное состояние при любом выходе из
+// autotune(): параметры, состояние оптимизатора, пул, ядро и файл профилей
+class TuningGuard
+{
+private:
+    Network&            _net;
+    Optimizer&          _opt;
+    std::vector<Scalar> _param;
+    std::vector<Scalar> _opt_state;
+    ThreadPool*         _pool;
+    int                 _kernel;
+    std::string         _tuning_file;
+
+public:
+    TuningGuard(Network& net, Optimizer& opt) :
+        _net(net), _opt(opt), _param(net.num_parameters()), _opt_state(opt.state_size()),
+        _pool(net.get_thread_pool()), _kernel(net.kernel()), _tuning_file(net.tuning_file())
+    {
+        net.copy_parameters(_param.data());
+        opt.copy_state(_opt_state.data());
+    }
+
+    TuningGuard(const TuningGuard&) = delete;
+    TuningGuard& operator=(const TuningGuard&) = delete;
+
+    ~TuningGuard()
+    {
+        _net.set_thread_pool(_pool);
+        _net.set_kernel(_kernel);
+        _net.load_parameters(_param.data());
+        _opt.load_state(_opt_state.data());
+        _net.set_tuning_file(_tuning_file);
+    }
+};
+
+}
+
+/// Подобрать размер пакета, количество потоков и ядро умножения матриц
+/// по измеренной пропускной способности на данном процессоре.
+///
+/// Для каждой комбинации из пространства поиска выполняется несколько коротких
+/// шагов обучения (forward, backprop, update) и отдельно прогноз; выбираются
+/// комбинации с наибольшим числом наблюдений в секунду. Параметры, пул потоков и
+/// ядро сети и состояние оптимизатора после подбора восстанавливаются. Если задан файл,
+/// профиль сохраняется в нем под ключом (модель процессора, форма сети), и
+/// сети с Network::set_tuning_file() применяют его автоматически.
+///
+/// Пробные шаги не вызывают обратный вызов и телеметрию сети, не меняют счетчик
+/// шагов train_step() и не синхронизируют градиенты с другими процессами.
+///
+/// \param net         Инициализированная сеть.
+/// \param opt         Оптимизатор, используемый для обучения.
+/// \param x           Выборка предикторов. Каждый столбец представляет собой наблюдение.
+/// \param y           Выборка переменной ответа.
+/// \param batch_sizes Кандидаты размера пакета. Размеры больше выборки пропускаются.
+/// \param nthreads    Кандидаты количества потоков (включая вызывающий).
+/// \param nstep       Количество измеряемых шагов на каждую комбинацию.
+/// \param filename    Файл профилей, пустая строка - не сохранять.
+inline TuningProfile autotune(Network& net, Optimizer& opt, const Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>& x,
+                              const Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>& y,
+                              const std::vector<int>& batch_sizes, const std::vector<int>& nthreads,
+                              int nstep = 20, const std::string& filename = "")
+{
+    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+
+    if (net.num_layers() <= 0 || x.cols() != y.cols() || x.cols() <= 0)
+        throw std::invalid_argument("[function autotune]: Network is empty or data have incorrect dimension");
+
+    const int kernels[] = {internal::KERNEL_BLOCKED, internal::KERNEL_LAZY};
+    const int nkernel = sizeof(kernels) / sizeof(kernels[0]);
+
+    // Пул пробной комбинации объявлен до охранника, поэтому удаляется после того,
+    // как охранник вернет сети пул пользователя
+    std::unique_ptr<ThreadPool> pool;
+    // Пробные шаги меняют параметры, охранник восстанавливает их вместе с
+    // состоянием оптимизатора, пулом и ядром сети
+    internal::TuningGuard guard(net, opt);
+    net.set_tuning_file("");
+
+    TuningProfile best;
+    double best_train = -1, best_predict = -1;
+
+    for (std::size_t t = 0; t < nthreads.size(); t++)
+    {
+        const int nthread = std::max(1, nthreads[t]);
+        net.set_thread_pool(NULL);
+        pool.reset((nthread > 1) ? new ThreadPool(nthread - 1) : NULL);
+        net.set_thread_pool(pool.get());
+
+        for (int k = 0; k < nkernel; k++)
+        {
+            net.set_kernel(kernels[k]);
+
+            for (std::size_t b = 0; b < batch_sizes.size(); b++)
+            {
+                const int bsize = batch_sizes[b];
+
+                if (bsize <= 0 || bsize > x.cols()) continue;
+
+                const Matrix xb = x.leftCols(bsize);
+                const Matrix yb = y.leftCols(bsize);
+                internal::tuning_step(net, opt, xb, yb);   // Прогрев: буферы, кэши, потоки
+                const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+                for (int i = 0; i < nstep; i++) internal::tuning_step(net, opt, xb, yb);
+
+                const double throughput = double(nstep) * bsize / internal::elapsed(start);
+
+                if (throughput > best_train)
+                {
+                    best_train = throughput;
+                    best.batch_size = bsize;
+                    best.nthread = nthread;
+                    best.kernel = kernels[k];
+                }
+            }
+
+            // Прогноз на всей выборке
+            Matrix pred;
+            net.predict(x, pred);
+            const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+            for (int i = 0; i < nstep; i++) net.predict(x, pred);
+
+            const double throughput = double(nstep) * x.cols() / internal::elapsed(start);
+
+            if (throughput > best_predict)
+            {
+                best_predict = throughput;
+                best.predict_nthread = nthread;
+                best.predict_kernel = kernels[k];
+            }
+        }
+
+    }
+
+    if (best_train < 0)
+        throw std::invalid_argument("[function autotune]: No batch size candidate fits the data");
+
+    if (!filename.empty()) save_tuning_profile(filename, cpu_model() + "|" + net.shape_key(), best);
+
+    return best;
+}
+
+}
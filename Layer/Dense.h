@@ -1,5 +1,9 @@
+#pragma once
+
+#include <new>
 #include "Layer.h"
 #include "Utilities/Random.h"
+#include "Utilities/Enum.h"
 
 namespace  NNE
 {
@@ -15,12 +19,50 @@ private:
     Vector _v_bias;    // Параметры смещения, b(out_size -- 1)
     Matrix _m_dw;      // Производная весов
     Vector _v_db;      // Производная смещения
-    Matrix _m_z;       // Линейный термин, z = W' * in + b
-    Matrix _m_a;       // Вывод этого слоя, a = act(z)
-    Matrix _m_din;     // Производная входа этого слоя, также является выходом предыдущего слоя.
+    MapMat _m_z;       // Линейный термин, z = W' * in + b
+    MapMat _m_a;       // Вывод этого слоя, a = act(z)
+    MapMat _m_din;     // Производная входа этого слоя, также является выходом предыдущего слоя.
+    int    _max_batch; // Количество столбцов, на которое рассчитаны буферы в арене
+
+    // Буферы размещены в арене, поэтому смена размера пакета только
+    // переназначает отображение на начало того же буфера
+    static void remap(MapMat& map, int rows, int cols)
+    {
+        new (&map) MapMat(map.data(), rows, cols);
+    }
+
+    void check_batch(int nobs) const
+    {
+        if (nobs > _max_batch)
+            throw std::invalid_argument("[class Dense]: Batch size exceeds reserved buffers");
+    }
+
+    // Минимальное число столбцов на поток, чтобы накладные расходы пула окупались
+    int grain(int work_per_col) const
+    {
+        return std::max(1, 32768 / std::max(1, work_per_col));
+    }
+
+    // Произведение выбранным ядром, результат записывается в `dest` или прибавляется к нему
+    template <typename Dest, typename Lhs, typename Rhs>
+    void gemm(Dest dest, const Lhs& lhs, const Rhs& rhs, bool accumulate) const
+    {
+        if (this->_kernel == internal::KERNEL_LAZY)
+        {
+            if (accumulate) dest.noalias() += lhs.lazyProduct(rhs);
+            else dest.noalias() = lhs.lazyProduct(rhs);
+        }
+        else
+        {
+            if (accumulate) dest.noalias() += lhs * rhs;
+            else dest.noalias() = lhs * rhs;
+        }
+    }
 
 public:
-    Dense(const int in_size, const int out_size) : Layer(in_size,out_size){}
+    Dense(const int in_size, const int out_size) : Layer(in_size,out_size),
+        _m_z(NULL, 0, 0), _m_a(NULL, 0, 0), _m_din(NULL, 0, 0), _max_batch(0)
+    {}
 
     void init(const Scalar& mu, const Scalar& sigma, RNG& rng)
     {
@@ -29,6 +71,16 @@ public:
         internal::set_normal_random(_m_weight.data(), _m_weight.size(), rng, mu, sigma);
         internal::set_normal_random(_v_bias.data(), _v_bias.size(), rng, mu, sigma);
     }
+    Layer* clone() const
+    {
+        Dense<Activation>* res = new Dense<Activation>(this->_in_size, this->_out_size);
+        res->_m_weight = _m_weight;
+        res->_v_bias = _v_bias;
+        res->_m_dw.resize(_m_dw.rows(), _m_dw.cols());
+        res->_v_db.resize(_v_db.size());
+        return res;
+    }
+
     // Установить размерность параметра
     void init()
     {
@@ -38,22 +90,82 @@ public:
         _v_db.resize(this->_out_size);
     }
 
+    std::size_t buffer_size(int max_batch) const
+    {
+        return Arena::aligned_size(std::size_t(this->_out_size) * max_batch) * 2 +
+               Arena::aligned_size(std::size_t(this->_in_size) * max_batch);
+    }
+
+    void bind_buffers(Arena& arena, int max_batch)
+    {
+        new (&_m_z) MapMat(arena.allocate(std::size_t(this->_out_size) * max_batch), this->_out_size, 0);
+        new (&_m_a) MapMat(arena.allocate(std::size_t(this->_out_size) * max_batch), this->_out_size, 0);
+        new (&_m_din) MapMat(arena.allocate(std::size_t(this->_in_size) * max_batch), this->_in_size, 0);
+        _max_batch = max_batch;
+    }
+
     // данные предыдущего слоя: in_size x nobs
-    void forward(const Matrix& prev_layer_data)
+    void forward(const ConstRefMat& prev_layer_data)
     {
         const int nobs = prev_layer_data.cols();
-        // Линейный термин z = W' * in + b
-        _m_z.resize(this->_out_size, nobs);
-        _m_z.noalias() = _m_weight.transpose() * prev_layer_data;
-        _m_z.colwise() += _v_bias;
-        // Применить функцию активации
-        _m_a.resize(this->_out_size, nobs);
-        Activation::activate(_m_z, _m_a);
+        check_batch(nobs);
+        remap(_m_z, this->_out_size, nobs);
+        remap(_m_a, this->_out_size, nobs);
+        // Наблюдения независимы, поэтому столбцы делятся между потоками
+        internal::parallel_for(this->_pool, 0, nobs, grain(this->_in_size * this->_out_size),
+                               [&](int b, int e)
+        {
+            // Линейный термин z = W' * in + b
+            gemm(_m_z.middleCols(b, e - b), _m_weight.transpose(), prev_layer_data.middleCols(b, e - b), false);
+            _m_z.middleCols(b, e - b).colwise() += _v_bias;
+            // Применить функцию активации
+            Activation::activate(_m_z.middleCols(b, e - b), _m_a.middleCols(b, e - b));
+        });
+    }
+
+    ConstMapMat output() const
+    {
+        return ConstMapMat(_m_a.data(), _m_a.rows(), _m_a.cols());
+    }
+
+    // данные предыдущего слоя: in_size x nobs
+    // данные следующего слоя: out_size x nobs
+    void backprop(const ConstRefMat& prev_layer_data, const ConstRefMat& next_layer_data)
+    {
+        const int nobs = prev_layer_data.cols();
+        // Множитель градиентов параметров: 1 / nobs или 1 / размер логического пакета
+        const Scalar scale = (this->_grad_scale > 0) ? this->_grad_scale : Scalar(1) / nobs;
+        // Производная по z, dL/dz = J * dL/da, сохраняется поверх _m_z
+        MapMat& dLz = _m_z;
+        remap(_m_din, this->_in_size, nobs);
+        internal::parallel_for(this->_pool, 0, nobs, grain(this->_in_size * this->_out_size),
+                               [&](int b, int e)
+        {
+            Activation::jacobian(_m_z.middleCols(b, e - b), _m_a.middleCols(b, e - b),
+                                 next_layer_data.middleCols(b, e - b), dLz.middleCols(b, e - b));
+            // Производная входа d(L) / d(in) = W * (dL/dz), потоки делят наблюдения
+            gemm(_m_din.middleCols(b, e - b), _m_weight, dLz.middleCols(b, e - b), false);
+            // Дальше dL/dz нужна только для градиентов параметров, масштабируем ее на месте
+            dLz.middleCols(b, e - b) *= scale;
+        });
+        // Производная весов dW = in * (scale * dL/dz)', потоки делят выходные единицы.
+        // В режиме накопления градиенты прибавляются без дополнительных буферов
+        internal::parallel_for(this->_pool, 0, this->_out_size, grain(this->_in_size * nobs),
+                               [&](int b, int e)
+        {
+            gemm(_m_dw.middleCols(b, e - b), prev_layer_data, dLz.middleRows(b, e - b).transpose(),
+                 this->_accumulate);
+
+            if (this->_accumulate)
+                _v_db.segment(b, e - b).noalias() += dLz.middleRows(b, e - b).rowwise().sum();
+            else
+                _v_db.segment(b, e - b).noalias() = dLz.middleRows(b, e - b).rowwise().sum();
+        });
     }
 
-    const Matrix& backprop_data() const
+    ConstMapMat backprop_data() const
     {
-        return _m_din;
+        return ConstMapMat(_m_din.data(), _m_din.rows(), _m_din.cols());
     }
 
     void update(Optimizer& opt)
@@ -96,6 +208,35 @@ public:
         return res;
     }
 
+    void copy_derivatives(Scalar* dest) const
+    {
+        std::copy(_m_dw.data(), _m_dw.data() + _m_dw.size(), dest);
+        std::copy(_v_db.data(), _v_db.data() + _v_db.size(), dest + _m_dw.size());
+    }
+
+    void load_derivatives(const Scalar* src)
+    {
+        std::copy(src, src + _m_dw.size(), _m_dw.data());
+        std::copy(src + _m_dw.size(), src + _m_dw.size() + _v_db.size(), _v_db.data());
+    }
+
+    std::size_t num_parameters() const
+    {
+        return _m_weight.size() + _v_bias.size();
+    }
+
+    void copy_parameters(Scalar* dest) const
+    {
+        std::copy(_m_weight.data(), _m_weight.data() + _m_weight.size(), dest);
+        std::copy(_v_bias.data(), _v_bias.data() + _v_bias.size(), dest + _m_weight.size());
+    }
+
+    void load_parameters(const Scalar* src)
+    {
+        std::copy(src, src + _m_weight.size(), _m_weight.data());
+        std::copy(src + _m_weight.size(), src + _m_weight.size() + _v_bias.size(), _v_bias.data());
+    }
+
     std::string layer_type() const
     {
         return "Dense";
@@ -106,7 +247,7 @@ public:
         return Activation::return_type();
     }
 
-    void fill_meta_info(Info& map, int index) const
+    void fill_info(Info& map, int index) const
     {
         //std::string ind = internal::to_string(index);
         std::string ind = std::to_string(index);
@@ -4,6 +4,8 @@
 #include "InitScalar.h"
 #include "Utilities/RNG.h"
 #include "Optimizer/Optimizer.h"
+#include "Utilities/ThreadPool.h"
+#include "Utilities/Arena.h"
 #include <vector>
 #include <map>
 
@@ -14,32 +16,61 @@ class Layer
 protected:
     typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
     typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+    typedef Eigen::Map<Matrix> MapMat;
+    typedef Eigen::Map<const Matrix> ConstMapMat;
+    typedef Eigen::Ref<const Matrix> ConstRefMat;
     typedef std::map<std::string, int> Info;
 
     const int _in_size;  // Размер входных единиц
     const int _out_size; // Размер выходных единиц
+    ThreadPool* _pool;   // Пул потоков для параллельных циклов, NULL - последовательное выполнение
+    bool _accumulate;    // Прибавлять градиенты параметров к уже накопленным
+    Scalar _grad_scale;  // Множитель градиентов параметров, <= 0 означает 1 / nobs
+    int _kernel;         // Ядро умножения матриц, см. internal::KERNEL_ENUM
 public:
     Layer(const int in_size, const int out_size) :
-           _in_size(in_size),_out_size(out_size)
+           _in_size(in_size),_out_size(out_size), _pool(NULL),
+           _accumulate(false), _grad_scale(0), _kernel(0)
     {}
 
     virtual ~Layer() {}
+    /// Создать новый слой того же типа и размера с копией параметров.
+    /// Промежуточные буферы копии не привязаны, пул потоков не задан.
+    virtual Layer* clone() const = 0;
     int in_size() const { return _in_size;}
     int out_size() const { return _out_size;}
+    /// Задать общий пул потоков, NULL отключает параллельное выполнение
+    void set_thread_pool(ThreadPool* pool) { _pool = pool;}
+    /// Выбрать ядро умножения матриц, см. internal::KERNEL_ENUM
+    void set_kernel(int kernel) { _kernel = kernel;}
+    /// Режим накопления градиентов для обработки логического пакета частями
+    /// \param accumulate Прибавлять градиенты к накопленным, а не перезаписывать их.
+    /// \param scale      Множитель градиентов (обычно 1 / размер логического пакета),
+    ///                   `scale <= 0` означает 1 / размер текущего пакета.
+    void set_gradient_mode(bool accumulate, const Scalar& scale)
+    {
+        _accumulate = accumulate;
+        _grad_scale = scale;
+    }
     /// \param ndm    Среднее нормального распределения.
     /// \param sigma  Стандартное отклонение нормального распределения.
     /// \param rng    Генератор случайных чисел типа RNG.
     virtual void init(const Scalar& ndm, const Scalar& sigma, RNG& rng) = 0;
     virtual void init() = 0;
     /// Вычисляет выходные данные этого слоя.
-    virtual void forward(const Matrix& layer_data) = 0;
+    virtual void forward(const ConstRefMat& layer_data) = 0;
     /// Выходные значения этого слоя
-    virtual const Matrix& output() const = 0;
+    virtual ConstMapMat output() const = 0;
     /// Вычислить градиенты параметров и входных единиц, используя обратное распространение
-    virtual void backprop(const Matrix& prev_layer_data,
-                          const Matrix& next_layer_data) = 0;
+    virtual void backprop(const ConstRefMat& prev_layer_data,
+                          const ConstRefMat& next_layer_data) = 0;
     /// Градиент входных единиц этого слоя
-    virtual const Matrix& backprop_data() const = 0;
+    virtual ConstMapMat backprop_data() const = 0;
+    /// Размер в байтах промежуточных буферов слоя для пакета из `max_batch` наблюдений
+    virtual std::size_t buffer_size(int max_batch) const = 0;
+    /// Разместить промежуточные буферы в арене, рассчитанной на `max_batch` наблюдений.
+    /// После этого forward() и backprop() не выделяют память для пакетов не больше `max_batch`.
+    virtual void bind_buffers(Arena& arena, int max_batch) = 0;
     /// Обновить параметры после обратного распространения
     /// \param opt Используемый алгоритм оптимизации.
     virtual void update(Optimizer& opt) = 0;
@@ -49,6 +80,16 @@ public:
     virtual void set_parameters(const std::vector<Scalar>& param) {};
     /// Получить значения градиента параметров
     virtual std::vector<Scalar> get_derivatives() const = 0;
+    /// Скопировать градиенты параметров в `dest` в том же порядке, что и get_derivatives(), без выделения памяти
+    virtual void copy_derivatives(Scalar* dest) const = 0;
+    /// Заменить градиенты параметров значениями из `src`, например усредненными между процессами
+    virtual void load_derivatives(const Scalar* src) = 0;
+    /// Количество параметров слоя
+    virtual std::size_t num_parameters() const = 0;
+    /// Скопировать параметры в `dest` в том же порядке, что и get_parameters(), без выделения памяти
+    virtual void copy_parameters(Scalar* dest) const = 0;
+    /// Загрузить параметры из `src`, записанные copy_parameters()
+    virtual void load_parameters(const Scalar* src) = 0;
     virtual std::string layer_type() const = 0;
     virtual std::string activation_type() const = 0;
     virtual void fill_info(Info& map, int index) const = 0;
@@ -1,20 +1,50 @@
 #pragma once
 
 #include <vector>
+#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <chrono>
+#include <limits>
+#include <type_traits>
 #include <stdexcept>
 #include "InitScalar.h"
 #include "Utilities/RNG.h"
+#include "Utilities/Random.h"
+#include "Utilities/ThreadPool.h"
+#include "Utilities/Arena.h"
+#include "Utilities/Reservoir.h"
+#include "Utilities/Checkpoint.h"
+#include "Utilities/Validation.h"
+#include "Utilities/TuningProfile.h"
+#include "Utilities/AllReduce.h"
+#include "Utilities/Enum.h"
 #include "Layer/Layer.h"
 #include "Utilities/Callback.h"
 #include "Output/Output.h"
 
 namespace NNE
 {
+    class Network;
+
+    namespace internal
+    {
+        // Шаг обучения для замеров autotune(), определен в Autotune.h
+        inline void tuning_step(Network& net, Optimizer& opt,
+                                const Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>& x,
+                                const Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>& y);
+    }
+
     class Network
     {
+        friend void internal::tuning_step(Network& net, Optimizer& opt, const Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>& x,
+                                          const Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>& y);
+
      private:
         typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
         typedef Eigen::RowVectorXi IntegerVector;
+        typedef Eigen::Ref<const Matrix> ConstRefMat;
         typedef std::map<std::string, int> MetaInfo;
 
         RNG                 _default_rng;      // Встроенный ГСЧ
@@ -25,61 +55,481 @@ namespace NNE
         Callback            _default_callback; // Функция обратного вызова по умолчанию
         Callback*           _callback;         // Указывает на предоставленную пользователем функцию обратного вызова,
                                                // иначе указывает на _default_callback
+        ThreadPool*         _pool;             // Общий пул потоков, NULL - последовательное выполнение
+        Arena               _arena;            // Память промежуточных буферов слоев
+        int                 _max_batch;        // Размер пакета, на который рассчитана арена
+        int                 _nstep;            // Количество шагов онлайн-обучения
+        Checkpointer*       _checkpointer;     // Запись контрольных точек, NULL - отключена
+        unsigned long       _shuffle_rng;      // Состояние ГСЧ перед перемешиванием мини-пакетов в fit()
+        bool                _resume;           // Следующий fit() продолжает обучение с контрольной точки
+        int                 _resume_epoch;     // Эпоха и пакет, с которых продолжается обучение
+        int                 _resume_batch;
+        int                 _resume_batch_size;
+        int                 _resume_val_epoch; // Эпоха незавершенной проверки в контрольной точке, -1 - нет
+        Scalar              _resume_val_loss;
+        StoppingState       _resume_stopping;  // Состояние ранней остановки из контрольной точки
+        const Matrix*       _x_val;            // Проверочный набор, NULL - без проверки
+        const Matrix*       _y_val;
+        EarlyStopping*      _stopping;         // Политика ранней остановки, NULL - без нее
+        InferenceContext*   _val_ctx;          // Контекст вывода для фоновой проверки
+        std::vector<Scalar> _val_param;        // Снимок параметров, который сейчас проверяется
+        ThreadPool*         _val_pool;         // Пул, в котором идет проверка, NULL - выполнена сразу
+        bool                _val_running;      // Запущенная проверка еще не учтена
+        std::atomic<bool>   _val_done;         // Задача проверки завершилась
+        std::exception_ptr  _val_error;        // Исключение задачи проверки
+        Scalar              _val_result;       // Потери, посчитанные задачей проверки
+        int                 _val_chunk;        // Размер части проверочного набора
+        int                 _val_epoch;        // Эпоха снимка, который сейчас проверяется
+        Scalar              _val_loss;         // Потери последней завершенной проверки
+        int                 _micro_batch;      // Размер части логического пакета, 0 - без накопления градиентов
+        Scalar              _loss;             // Потери на последнем логическом пакете
+        IntegerVector       _labels;           // Метки классов текущего пакета для выходного слоя
+        int                 _kernel;           // Ядро умножения матриц, выбранное пользователем
+        std::string         _tuning_file;      // Файл профилей производительности, пусто - не использовать
+        bool                _tuning_loaded;    // Профиль для текущей формы сети уже искали
+        bool                _has_profile;      // Профиль найден
+        TuningProfile       _profile;          // Профиль для текущего процессора и формы сети
+        ThreadPool*         _tuned_pool;       // Пул обучения и прогноза по профилю, принадлежит сети
+        GradientSync*       _sync;             // Усреднение градиентов между процессами, NULL - без него
+        std::size_t         _bucket_size;      // Минимальный размер корзины градиентов в скалярах
+        std::vector<std::size_t> _grad_offset; // Начало градиентов слоя в плоском буфере
+        std::size_t         _bucket_end;       // Конец еще не переданной корзины
+        bool                _sync_grad;        // Текущий обратный проход завершает логический пакет
 
         //Проверьте размеры слоев
-        void check_unit_sizes() const;
-
-        // Пусть каждый слой вычисляет свой вывод
-        void forward(const Matrix& input)
+        void check_unit_sizes() const
         {
             const int nlayer = num_layers();
 
             if (nlayer <= 1) return;
 
             for (int i = 1; i < nlayer; i++)
+            {
+                if (_layers[i]->in_size() != _layers[i - 1]->out_size())
                 {
-                  if (_layers[i]->in_size() != _layers[i - 1]->out_size())
-                     {
-                        throw std::invalid_argument("[class Network]: Unit sizes do not match ");
-                     }
-               } 
+                    throw std::invalid_argument("[class Network]: Unit sizes do not match");
+                }
+            }
+        }
+
+        // Пусть каждый слой вычисляет свой вывод
+        void forward(const ConstRefMat& input)
+        {
+            const int nlayer = num_layers();
+
+            if (nlayer <= 0) return;
+
+            if (input.rows() != _layers[0]->in_size())
+                throw std::invalid_argument("[class Network]: Input data have incorrect dimension");
+
+            if (input.cols() > _max_batch) reserve(input.cols());
+
+            _layers[0]->forward(input);
+
+            for (int i = 1; i < nlayer; i++) _layers[i]->forward(_layers[i - 1]->output());
         }
 
         // Пусть каждый слой вычисляет свои градиенты параметров
         // цель имеет две версии: Matrix and RowVectorXi
         // Версия RowVectorXi используется в задачах классификации, где каждый
         // элемент является меткой класса
+        // Передать целевые данные выходному слою. Вещественные цели (в том числе блоки
+        // столбцов) передаются как Ref без копирования, метки классов - как IntegerVector
+        template <typename Derived>
+        void evaluate_output(const ConstRefMat& prev_layer_data, const Eigen::MatrixBase<Derived>& target,
+                             std::false_type)
+        {
+            const ConstRefMat ref(target);
+            _output->check_target_data(ref);
+            _output->evaluate(prev_layer_data, ref);
+        }
+
+        template <typename Derived>
+        void evaluate_output(const ConstRefMat& prev_layer_data, const Eigen::MatrixBase<Derived>& target,
+                             std::true_type)
+        {
+            // Метки копируются в буфер сети, память выделяется только при смене размера пакета
+            _labels = target;
+            _output->check_target_data(_labels);
+            _output->evaluate(prev_layer_data, _labels);
+        }
+
+        template <typename TargetType>
+        void backprop(const ConstRefMat& input, const TargetType& target)
+        {
+            const int nlayer = num_layers();
+
+            if (nlayer <= 0) return;
+
+            Layer* first_layer = _layers[0];
+            Layer* last_layer = _layers[nlayer - 1];
+            // Выходной слой вычисляет производную своего входа
+            evaluate_output(last_layer->output(), target,
+                            std::is_integral<typename TargetType::Scalar>());
+
+            // Если есть только один скрытый слой, "prev_layer_data" будет входными данными
+            if (nlayer == 1)
+            {
+                first_layer->backprop(input, _output->backprop_data());
+                gradient_ready(0);
+                return;
+            }
+
+            last_layer->backprop(_layers[nlayer - 2]->output(), _output->backprop_data());
+            gradient_ready(nlayer - 1);
+
+            for (int i = nlayer - 2; i > 0; i--)
+            {
+                _layers[i]->backprop(_layers[i - 1]->output(), _layers[i + 1]->backprop_data());
+                gradient_ready(i);
+            }
+
+            first_layer->backprop(input, _layers[1]->backprop_data());
+            gradient_ready(0);
+        }
+
+        // Разметить плоский буфер градиентов перед обратным проходом, который
+        // завершает логический пакет. После первого раза память не выделяется.
+        void prepare_sync()
+        {
+            const int nlayer = num_layers();
+            _grad_offset.resize(nlayer + 1);
+            _grad_offset[0] = 0;
+
+            for (int i = 0; i < nlayer; i++)
+                _grad_offset[i + 1] = _grad_offset[i] + _layers[i]->num_parameters();
+
+            _sync->resize(_grad_offset[nlayer], nlayer);
+            _bucket_end = _grad_offset[nlayer];
+            _sync_grad = true;
+        }
+
+        // Градиенты слоя `i` готовы. Слои завершаются от последнего к первому, поэтому
+        // корзина - непрерывный диапазон буфера, растущий к началу; заполненная корзина
+        // усредняется в фоне, пока считаются градиенты предыдущих слоев.
+        void gradient_ready(int i)
+        {
+            if (!_sync_grad) return;
+
+            _layers[i]->copy_derivatives(_sync->data() + _grad_offset[i]);
+
+            if (i == 0 || _bucket_end - _grad_offset[i] >= _bucket_size)
+            {
+                _sync->submit(_grad_offset[i], _bucket_end);
+                _bucket_end = _grad_offset[i];
+            }
+        }
+
+        // Шаг обучения на логическом пакете. Если задан размер части, пакет
+        // обрабатывается частями с накоплением градиентов в буферах слоев, а
+        // параметры обновляются один раз.
         template <typename TargetType>
-        void backprop(const Matrix& input, const TargetType& target){}
+        void train_batch(Optimizer& opt, const ConstRefMat& x, const TargetType& y)
+        {
+            const int nobs = x.cols();
+
+            if (_micro_batch <= 0 || _micro_batch >= nobs)
+            {
+                if (_sync) prepare_sync();
+
+                this->forward(x);
+                this->backprop(x, y);
+                _loss = _output->loss();
+                this->update(opt);
+                return;
+            }
+
+            double loss = 0;
 
-        // Обновить параметры
-        void update(Optimizer& opt){}
+            for (int b = 0; b < nobs; b += _micro_batch)
+            {
+                const int n = std::min(_micro_batch, nobs - b);
+
+                for (int i = 0; i < num_layers(); i++)
+                    _layers[i]->set_gradient_mode(b > 0, Scalar(1) / nobs);
+
+                // Градиенты передаются только после последней части
+                if (_sync && b + n >= nobs) prepare_sync();
+
+                this->forward(x.middleCols(b, n));
+                this->backprop(x.middleCols(b, n), y.middleCols(b, n));
+                // Потери части усреднены по ее наблюдениям, взвешиваем их размером части
+                loss += double(_output->loss()) * n;
+            }
+
+            for (int i = 0; i < num_layers(); i++) _layers[i]->set_gradient_mode(false, Scalar(0));
+
+            _loss = Scalar(loss / nobs);
+            this->update(opt);
+        }
+
+        // Шаг обучения с замером времени для телеметрии. Время измеряет сеть, а не
+        // переопределяемые методы обратного вызова.
+        template <typename TargetType>
+        void timed_train_batch(Optimizer& opt, const ConstRefMat& x, const TargetType& y)
+        {
+            const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            this->train_batch(opt, x, y);
+            _callback->_batch_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        // Обновить параметры. При обучении в нескольких процессах градиенты
+        // сначала заменяются средними по всем процессам.
+        void update(Optimizer& opt)
+        {
+            if (_sync_grad)
+            {
+                _sync_grad = false;
+                _sync->wait();
+
+                for (int i = 0; i < num_layers(); i++)
+                    _layers[i]->load_derivatives(_sync->data() + _grad_offset[i]);
+            }
+
+            for (int i = 0; i < num_layers(); i++) _layers[i]->update(opt);
+        }
+
+        // Шаг онлайн-обучения. Обратный вызов получает пакет (x, y), а шаг делается на
+        // (train_x, train_y): том же пакете или пакете, смешанном с резервуаром.
+        template <typename TargetType, typename TrainTarget>
+        bool online_step(Optimizer& opt, const Matrix& x, const TargetType& y,
+                         const ConstRefMat& train_x, const TrainTarget& train_y)
+        {
+            if (num_layers() <= 0) return false;
+
+            apply_tuning(false);
+            _callback->_nbatch = 1;
+            _callback->_nepoch = 1;
+            _callback->_epoch_id = 0;
+            _callback->_batch_id = _nstep++;
+            _callback->pre_training_batch(this, x, y);
+            timed_train_batch(opt, train_x, train_y);
+            _callback->post_training_batch(this, x, y);
+            return true;
+        }
+
+        // Скопировать параметры, состояние оптимизатора и позицию обучения в буфер
+        // контрольной точки. После первого вызова память не выделяется.
+        void save_checkpoint(const Optimizer& opt, int epoch, int batch, int batch_size)
+        {
+            Checkpoint& ckpt = _checkpointer->acquire();
+            ckpt.param.resize(num_parameters());
+            ckpt.opt_state.resize(opt.state_size());
+            copy_parameters(ckpt.param.data());
+            opt.copy_state(ckpt.opt_state.data());
+            ckpt.rng_state = _shuffle_rng;
+            ckpt.epoch = epoch;
+            ckpt.batch = batch;
+            ckpt.batch_size = batch_size;
+            // Проверка предыдущей эпохи к этому моменту может быть не завершена,
+            // сохраняем ее снимок, чтобы после продолжения повторить ее
+            ckpt.val_epoch = _val_running ? _val_epoch : -1;
+            ckpt.val_param.resize(ckpt.val_epoch >= 0 ? _val_param.size() : 0);
+            std::copy(_val_param.begin(), _val_param.begin() + ckpt.val_param.size(), ckpt.val_param.begin());
+            ckpt.val_loss = _val_loss;
+
+            if (_stopping) _stopping->get_state(ckpt.stopping);
+            else ckpt.stopping = StoppingState();
+
+            _checkpointer->commit();
+        }
+
+        // Сделать снимок параметров и запустить проверку в фоне.
+        // Поток обучения тратит время только на копирование параметров.
+        void launch_validation(int epoch)
+        {
+            _val_param.resize(num_parameters());
+            copy_parameters(_val_param.data());
+            start_validation(epoch);
+        }
+
+        // Оценить снимок на проверочном наборе и сообщить о завершении.
+        // Исключение сохраняется и пробрасывается в collect_validation().
+        void run_validation()
+        {
+            try
+            {
+                _val_result = _val_ctx->evaluate(*_x_val, *_y_val, _val_chunk);
+            }
+            catch (...)
+            {
+                _val_error = std::current_exception();
+            }
+
+            _val_done.store(true, std::memory_order_release);
+        }
+
+        // Запустить проверку снимка _val_param, сделанного после эпохи `epoch`.
+        // Проверка - задача общего пула сети (пула пользователя или пула профиля);
+        // без пула она выполняется сразу в потоке обучения.
+        void start_validation(int epoch)
+        {
+            _val_ctx->load_parameters(_val_param.data());
+            _val_epoch = epoch;
+            _val_error = nullptr;
+            _val_done.store(false, std::memory_order_relaxed);
+            _val_running = true;
+            _val_pool = _pool ? _pool : _tuned_pool;
+
+            if (_val_pool == NULL)
+            {
+                run_validation();
+                return;
+            }
+
+            // Задача захватывает один указатель, поэтому память не выделяется
+            Network* net = this;
+            _val_pool->post([net]() { net->run_validation(); });
+        }
+
+        // Дождаться задачи проверки, помогая пулу с другими задачами
+        void wait_validation()
+        {
+            if (_val_pool) _val_pool->wait(_val_done);
+
+            _val_running = false;
+        }
+
+        // Дождаться выполняющейся проверки и отбросить ее результат. Контекст проверки
+        // после этого можно удалять, а политика остановки не получит устаревших потерь.
+        void discard_validation()
+        {
+            if (_val_running) wait_validation();
+        }
+
+        // Отбрасывает проверку при любом выходе из fit(), в том числе по исключению
+        class ValidationGuard
+        {
+        private:
+            Network* _net;
+        public:
+            ValidationGuard(Network* net) : _net(net) {}
+            ~ValidationGuard() { _net->discard_validation();}
+        };
+
+        // Дождаться выполняющейся проверки и применить политику ранней остановки
+        // \return `true`, если обучение следует остановить.
+        bool collect_validation()
+        {
+            if (!_val_running) return false;
+
+            wait_validation();
+
+            if (_val_error) std::rethrow_exception(_val_error);
+
+            _val_loss = _val_result;
+
+            // Процессы усредняют потери своих проверочных наборов, поэтому решение
+            // об остановке во всех процессах одинаково и шаги обучения не расходятся
+            if (_sync)
+            {
+                Communicator* comm = _sync->communicator();
+                comm->allreduce(&_val_loss, 1);
+                _val_loss /= comm->size();
+            }
+
+            if (_stopping == NULL) return false;
+
+            return _stopping->update(_val_epoch, _val_loss, _val_param.data(), _val_param.size());
+        }
+
+        // Применить профиль производительности, если задан файл профилей.
+        // Пул пользователя имеет приоритет над количеством потоков из профиля.
+        // Иначе обучение и прогноз делят один собственный пул сети, рассчитанный
+        // на большее из двух количеств потоков; меньшее задается ограничением пула.
+        void apply_tuning(bool for_predict)
+        {
+            if (_tuning_file.empty()) return;
+
+            if (!_tuning_loaded)
+            {
+                _has_profile = load_tuning_profile(_tuning_file, cpu_model() + "|" + shape_key(), _profile);
+                _tuning_loaded = true;
+            }
+
+            if (!_has_profile) return;
+
+            const int nthread = for_predict ? _profile.predict_nthread : _profile.nthread;
+            const int nworker = std::max(_profile.nthread, _profile.predict_nthread) - 1;
+            ThreadPool* pool = _pool;
+
+            if (_pool == NULL && nworker > 0)
+            {
+                if (_tuned_pool == NULL || _tuned_pool->num_threads() != nworker)
+                {
+                    discard_validation();
+                    delete _tuned_pool;
+                    _tuned_pool = new ThreadPool(nworker);
+                }
+
+                _tuned_pool->set_concurrency(nthread);
+                pool = (nthread > 1) ? _tuned_pool : NULL;
+            }
+
+            for (int i = 0; i < num_layers(); i++)
+            {
+                _layers[i]->set_thread_pool(pool);
+                _layers[i]->set_kernel(for_predict ? _profile.predict_kernel : _profile.kernel);
+            }
+        }
 
         // Получите метаинформацию о сети, используемую для экспорта модели NN.
-        MetaInfo get_meta_info() const{}
+        MetaInfo get_meta_info() const
+        {
+            const int nlayer = num_layers();
+            MetaInfo map;
+            map.insert(std::make_pair("Nlayers", nlayer));
+
+            for (int i = 0; i < nlayer; i++) _layers[i]->fill_info(map, i);
+
+            return map;
+        }
 
      public:
         /// Конструктор по умолчанию, который создает пустую нейронную сеть
         Network() : _default_rng(1), _rng(_default_rng),_output(NULL),
-                    _default_callback(),_callback(&_default_callback) {}
+                    _default_callback(),_callback(&_default_callback), _pool(NULL), _max_batch(0), _nstep(0),
+                    _checkpointer(NULL), _shuffle_rng(0), _resume(false), _resume_val_epoch(-1),
+                    _x_val(NULL), _y_val(NULL), _stopping(NULL), _val_ctx(NULL), _val_pool(NULL), _val_running(false),
+                    _val_done(false), _val_result(0), _val_chunk(0), _val_epoch(-1),
+                    _val_loss(std::numeric_limits<Scalar>::quiet_NaN()), _micro_batch(0), _loss(0), _kernel(internal::KERNEL_BLOCKED),
+                    _tuning_loaded(false), _has_profile(false), _tuned_pool(NULL),
+                    _sync(NULL), _bucket_size(0), _bucket_end(0), _sync_grad(false) {}
 
         /// Конструктор с предоставленным пользователем генератором случайных чисел
         /// \param rng Предоставленный пользователем объект генератора случайных чисел, который наследует
         ///           из class RNG по умолчанию.
         Network(RNG& rng) : _default_rng(1), _rng(rng), _output(NULL),
-                _default_callback(), _callback(&_default_callback) {}
+                _default_callback(), _callback(&_default_callback), _pool(NULL), _max_batch(0), _nstep(0),
+                    _checkpointer(NULL), _shuffle_rng(0), _resume(false), _resume_val_epoch(-1),
+                    _x_val(NULL), _y_val(NULL), _stopping(NULL), _val_ctx(NULL), _val_pool(NULL), _val_running(false),
+                    _val_done(false), _val_result(0), _val_chunk(0), _val_epoch(-1),
+                    _val_loss(std::numeric_limits<Scalar>::quiet_NaN()), _micro_batch(0), _loss(0), _kernel(internal::KERNEL_BLOCKED),
+                    _tuning_loaded(false), _has_profile(false), _tuned_pool(NULL),
+                    _sync(NULL), _bucket_size(0), _bucket_end(0), _sync_grad(false) {}
 
         /// Деструктор, который освобождает добавленные скрытые слои и выходной слой
         ~Network()
         {
+            discard_validation();
+            delete _val_ctx;
             for (int i = 0; i < num_layers(); i++) delete _layers[i];
             if(_output) delete _output;
+            delete _tuned_pool;
+            delete _sync;
         }
 
         /// Добавьте скрытый слой в нейронную сеть
         /// **ПРИМЕЧАНИЕ**: указатель будет обработан и освобожден
         /// в сетевой объект, поэтому не удаляйте его вручную.
-        void add_layer(Layer* layer) { _layers.push_back(layer);}
+        void add_layer(Layer* layer)
+        {
+            layer->set_thread_pool(_pool);
+            layer->set_kernel(_kernel);
+            _layers.push_back(layer);
+            _max_batch = 0;
+            _tuning_loaded = false;
+        }
 
         /// Установите выходной слой нейронной сети
         /// **ПРИМЕЧАНИЕ**: указатель будет обработан и освобожден
@@ -88,6 +538,8 @@ namespace NNE
         {
             if (_output) delete _output;
             _output = output;
+            _max_batch = 0;
+            _tuning_loaded = false;
         }
 
         /// Количество скрытых слоев в сети
@@ -110,6 +562,53 @@ namespace NNE
         /// Установить функцию тихого обратного вызова по умолчанию
         void set_default_callback(){_callback = &_default_callback;}
 
+        /// Задать общий пул потоков для слоев и фоновых задач сети
+        /// **ПРИМЕЧАНИЕ**: пул не принадлежит сети и должен существовать, пока
+        /// сеть его использует. NULL возвращает последовательное выполнение.
+        void set_thread_pool(ThreadPool* pool)
+        {
+            _pool = pool;
+
+            for (int i = 0; i < num_layers(); i++) _layers[i]->set_thread_pool(pool);
+        }
+
+        /// Получить пул потоков сети
+        ThreadPool* get_thread_pool() const { return _pool;}
+
+        /// Задать распределитель памяти для промежуточных буферов слоев
+        /// **ПРИМЕЧАНИЕ**: распределитель не принадлежит сети. NULL возвращает
+        /// распределитель по умолчанию.
+        void set_allocator(Allocator* allocator)
+        {
+            _arena.set_allocator(allocator);
+            _max_batch = 0;
+        }
+
+        /// Разместить промежуточные буферы всех слоев для пакетов до `max_batch` наблюдений.
+        /// После этого обучение и прогноз на таких пакетах не выделяют память в куче.
+        void reserve(int max_batch)
+        {
+            const int nlayer = num_layers();
+
+            if (nlayer <= 0 || max_batch <= 0) return;
+
+            std::size_t bytes = 0;
+
+            for (int i = 0; i < nlayer; i++) bytes += _layers[i]->buffer_size(max_batch);
+
+            const int nvar = _layers[nlayer - 1]->out_size();
+
+            if (_output) bytes += _output->buffer_size(nvar, max_batch);
+
+            _arena.reserve(bytes);
+
+            for (int i = 0; i < nlayer; i++) _layers[i]->bind_buffers(_arena, max_batch);
+
+            if (_output) _output->bind_buffers(_arena, nvar, max_batch);
+
+            _max_batch = max_batch;
+        }
+
         /// Инициализируем параметры слоя в сети, используя нормальное распределение
         /// \param mu    Среднее значение нормального распределения.
         /// \param sigma Стандартное отклонение нормального распределения.
@@ -144,6 +643,198 @@ namespace NNE
             for (int i = 0; i < num_layers(); i++) _layers[i]->set_parameters(param[i]);
         }
 
+        /// Общее количество параметров всех слоев
+        std::size_t num_parameters() const
+        {
+            std::size_t res = 0;
+
+            for (int i = 0; i < num_layers(); i++) res += _layers[i]->num_parameters();
+
+            return res;
+        }
+
+        /// Скопировать параметры всех слоев подряд в `dest` без выделения памяти
+        void copy_parameters(Scalar* dest) const
+        {
+            for (int i = 0; i < num_layers(); i++)
+            {
+                _layers[i]->copy_parameters(dest);
+                dest += _layers[i]->num_parameters();
+            }
+        }
+
+        /// Загрузить параметры всех слоев из `src`, записанные copy_parameters()
+        void load_parameters(const Scalar* src)
+        {
+            for (int i = 0; i < num_layers(); i++)
+            {
+                _layers[i]->load_parameters(src);
+                src += _layers[i]->num_parameters();
+            }
+        }
+
+        /// Включить накопление градиентов: каждый пакет fit() и train_step() обрабатывается
+        /// частями по `micro_batch` наблюдений, градиенты суммируются в буферах слоев,
+        /// а оптимизатор вызывается один раз на пакет. Промежуточные буферы слоев
+        /// рассчитываются на `micro_batch` наблюдений. `0` отключает накопление.
+        void set_micro_batch(int micro_batch) { _micro_batch = (micro_batch > 0) ? micro_batch : 0;}
+
+        /// Значение функции потерь на последнем обученном (логическом) пакете
+        Scalar loss() const { return _loss;}
+
+        /// Выбрать ядро умножения матриц во всех слоях, см. internal::KERNEL_ENUM
+        void set_kernel(int kernel)
+        {
+            _kernel = kernel;
+
+            for (int i = 0; i < num_layers(); i++) _layers[i]->set_kernel(kernel);
+        }
+
+        /// Ядро умножения матриц, заданное set_kernel()
+        int kernel() const { return _kernel;}
+
+        /// Строка, описывающая форму сети: типы и размеры слоев и тип выходного слоя
+        std::string shape_key() const
+        {
+            std::string res;
+
+            for (int i = 0; i < num_layers(); i++)
+            {
+                res += _layers[i]->layer_type() + "-" + _layers[i]->activation_type() + "-" +
+                       std::to_string(_layers[i]->in_size()) + "x" + std::to_string(_layers[i]->out_size()) + ",";
+            }
+
+            res += _output ? _output->output_type() : std::string("none");
+            return res;
+        }
+
+        /// Задать файл профилей производительности, записанный autotune().
+        /// fit(), train_step(), partial_fit() и predict() применяют профиль для текущего процессора и формы сети
+        /// (ядро, количество потоков), а fit() с `batch_size <= 0` берет размер пакета
+        /// из профиля. Пустая строка отключает профили.
+        void set_tuning_file(const std::string& filename)
+        {
+            _tuning_file = filename;
+            _tuning_loaded = false;
+        }
+
+        /// Файл профилей производительности
+        const std::string& tuning_file() const { return _tuning_file;}
+
+        /// Включить синхронное обучение в нескольких процессах (data parallel).
+        /// Каждый процесс обучает свою копию сети на своей части данных; перед каждым
+        /// обновлением градиенты усредняются между процессами корзинами не меньше
+        /// `bucket_bytes` байт, параллельно с обратным распространением. fit() в начале
+        /// рассылает параметры процесса 0.
+        /// **ПРИМЕЧАНИЕ**: объект связи не принадлежит сети. Все процессы должны делать
+        /// одинаковое количество шагов обучения. NULL отключает синхронизацию.
+        /// Если задана проверка (set_validation()), ее должны задать все процессы:
+        /// потери проверки усредняются между процессами перед решением об остановке.
+        void set_communicator(Communicator* comm, std::size_t bucket_bytes = 1 << 20)
+        {
+            delete _sync;
+            _sync = comm ? new GradientSync(comm) : NULL;
+            _bucket_size = std::max<std::size_t>(1, bucket_bytes / sizeof(Scalar));
+        }
+
+        /// Объект связи между процессами, NULL - обучение в одном процессе
+        Communicator* get_communicator() const { return _sync ? _sync->communicator() : NULL;}
+
+        /// Заменить параметры всех процессов параметрами процесса 0
+        void broadcast_parameters()
+        {
+            if (!_sync) return;
+
+            // Буфер градиентов между шагами свободен, после первого раза память не выделяется.
+            // Сумма с нулями других процессов точно равна параметрам процесса 0
+            const std::size_t n = num_parameters();
+            _sync->resize(n, num_layers());
+            Scalar* param = _sync->data();
+            Communicator* comm = _sync->communicator();
+
+            if (comm->rank() == 0) copy_parameters(param);
+            else std::fill(param, param + n, Scalar(0));
+
+            comm->allreduce(param, n);
+            load_parameters(param);
+        }
+
+        /// Задать запись контрольных точек во время fit()
+        /// **ПРИМЕЧАНИЕ**: объект не принадлежит сети. NULL отключает контрольные точки.
+        void set_checkpointer(Checkpointer* checkpointer) { _checkpointer = checkpointer;}
+
+        /// Восстановить состояние из контрольной точки. Следующий вызов fit() с теми же
+        /// данными и размером пакета продолжит обучение с пакета, следующего за сохраненным,
+        /// с тем же порядком мини-пакетов. Сеть должна быть инициализирована.
+        /// Если задана проверка, восстанавливаются и состояние ранней остановки, и
+        /// незавершенная в момент точки проверка, поэтому результат совпадает с
+        /// непрерывным обучением (см. test_resume.cpp).
+        void resume(const Checkpoint& ckpt, Optimizer& opt)
+        {
+            if (ckpt.param.size() != num_parameters())
+                throw std::invalid_argument("[class Network]: Checkpoint parameter size does not match");
+
+            if (ckpt.opt_state.size() != opt.state_size())
+                throw std::invalid_argument("[class Network]: Checkpoint optimizer state size does not match");
+
+            load_parameters(ckpt.param.data());
+            opt.load_state(ckpt.opt_state.data());
+            _resume = true;
+            _resume_epoch = ckpt.epoch;
+            _resume_batch = ckpt.batch + 1;
+            _resume_batch_size = ckpt.batch_size;
+            _shuffle_rng = ckpt.rng_state;
+            _resume_val_epoch = ckpt.val_param.size() == num_parameters() ? ckpt.val_epoch : -1;
+            _resume_val_loss = ckpt.val_loss;
+            _resume_stopping = ckpt.stopping;
+
+            if (_resume_val_epoch >= 0) _val_param = ckpt.val_param;
+        }
+
+        /// Задать проверочный набор, который оценивается после каждой эпохи fit()
+        /// задачей общего пула потоков, параллельно со следующей эпохой. Без пула
+        /// проверка выполняется сразу после эпохи в потоке обучения.
+        /// **ПРИМЕЧАНИЕ**: данные и политика не копируются и должны существовать во время fit().
+        /// Из-за параллельной проверки решение об остановке принимается с опозданием на одну эпоху.
+        /// При обучении в нескольких процессах (set_communicator()) решение принимается
+        /// по средним потерям всех процессов.
+        ///
+        /// \param x        Предикторы проверочного набора.
+        /// \param y        Переменная ответа проверочного набора.
+        /// \param stopping Политика ранней остановки. После fit() в сеть загружаются
+        ///                 параметры с наилучшими потерями. NULL - без остановки.
+        void set_validation(const Matrix& x, const Matrix& y, EarlyStopping* stopping = NULL)
+        {
+            if (x.cols() != y.cols())
+                throw std::invalid_argument("[class Network]: Validation data X and Y have different numbers of observations");
+
+            _x_val = &x;
+            _y_val = &y;
+            _stopping = stopping;
+        }
+
+        /// Отключить проверку во время fit()
+        void clear_validation()
+        {
+            _x_val = NULL;
+            _y_val = NULL;
+            _stopping = NULL;
+        }
+
+        /// Потери на проверочном наборе по результатам последней завершенной проверки
+        Scalar validation_loss() const { return _val_loss;}
+
+        /// Скопировать градиенты параметров всех слоев подряд в `dest` без выделения
+        /// памяти, в том же порядке, что и copy_parameters()
+        void copy_derivatives(Scalar* dest) const
+        {
+            for (int i = 0; i < num_layers(); i++)
+            {
+                _layers[i]->copy_derivatives(dest);
+                dest += _layers[i]->num_parameters();
+            }
+        }
+
         /// Получить сериализованные производные параметров слоя
         std::vector< std::vector<Scalar> > get_derivatives() const
         {
@@ -183,7 +874,7 @@ namespace NNE
                 this->set_parameters(param);
                 this->forward(input);
                 this->backprop(input, target);
-                const Scalar loss_pre = m_output->loss();
+                const Scalar loss_pre = _output->loss();
                 param[layer_id][param_id] += eps * 2;
                 this->set_parameters(param);
                 this->forward(input);
@@ -201,10 +892,17 @@ namespace NNE
         }
 
         /// Собираем модель на основе заданных данных
+        ///
+        /// После первого пакета шаги обучения не выделяют память в куче (см. test_alloc.cpp).
+        /// Вне этой гарантии остаются подготовка перемешанных мини-пакетов в начале fit()
+        /// (create_shuffled_batches()) и первая проверка, которая размещает буферы
+        /// контекста проверки.
+        ///
         /// \param opt        Объект, наследуемый от класса Optimizer, указывающий используемый алгоритм оптимизации.
         /// \param x          Предикторы. Каждый столбец представляет собой наблюдение.
         /// \param y          Переменная ответа. Каждый столбец представляет собой наблюдение.
-        /// \param batch_size Размер мини-пакета.
+        /// \param batch_size Размер мини-пакета. Если `batch_size <= 0`, используется
+        ///                   размер из профиля производительности (см. set_tuning_file()).
         /// \param epoch      Количество эпох обучения.
         /// \param seed       Установить случайное начальное число %RNG, если `seed > 0`, иначе
         ///                   используем текущее случайное состояние.
@@ -223,39 +921,192 @@ namespace NNE
             YType;
 
             if(num_layers() <= 0) return false;
-            // Сброс оптимизатора
-            opt.reset();
+
+            // Проверка, оставшаяся от прерванного fit(), еще может работать с контекстом
+            discard_validation();
+            ValidationGuard validation_guard(this);
+
+            apply_tuning(false);
+
+            if (batch_size <= 0)
+            {
+                if (!_has_profile)
+                    throw std::invalid_argument("[class Network]: Batch size is not positive and no tuning profile is available");
+
+                batch_size = _profile.batch_size;
+            }
+
+            int start_epoch = 0, start_batch = 0;
+            const bool resumed = _resume;
+
+            if (_resume)
+            {
+                // Продолжение с контрольной точки: состояние оптимизатора уже восстановлено,
+                // ГСЧ возвращается в состояние перед перемешиванием
+                if (batch_size != _resume_batch_size)
+                    throw std::invalid_argument("[class Network]: Batch size does not match the checkpoint");
+
+                _resume = false;
+                start_epoch = _resume_epoch;
+                start_batch = _resume_batch;
+                _rng.seed(_shuffle_rng);
+
+                // Новый отсчет периода совпадает с отсчетом сразу после сохраненной точки
+                if (_checkpointer) _checkpointer->restart();
+            }
+            else
+            {
+                // Сброс оптимизатора
+                opt.reset();
+
+                if(seed > 0) _rng.seed(seed);
+
+                _shuffle_rng = _rng.state();
+            }
             // Создаем перетасованные мини-пакеты
-            if(seed > 0) _rng.seed(seed);
 
             std::vector<XType> x_batches;
             std::vector<YType> y_batches;
             const int nbatch = internal::create_shuffled_batches(x, y, batch_size, _rng,
                                x_batches, y_batches);
+            // Буферы слоев рассчитаны на полный пакет (или его часть при накоплении градиентов),
+            // последний неполный пакет использует их начало
+            int buffer_cols = x_batches[0].cols();
+
+            if (_micro_batch > 0 && _micro_batch < buffer_cols) buffer_cols = _micro_batch;
+
+            if (buffer_cols > _max_batch) reserve(buffer_cols);
+
+            // Копии сети в разных процессах начинают с одинаковых параметров
+            broadcast_parameters();
+
+            if (_checkpointer) _checkpointer->reserve(num_parameters(), opt.state_size());
             // Настройте параметры обратного вызова
             _callback->_nbatch = nbatch;
             _callback->_nepoch = epoch;
 
+            // Если точка сделана на последнем пакете эпохи, цикл начнется с этой эпохи
+            // без пакетов, чтобы выполнить ее проверку
+
+            if (_x_val)
+            {
+                // Контекст создается заново, так как слои сети могли измениться
+                delete _val_ctx;
+                _val_ctx = NULL;
+                _val_ctx = new InferenceContext(get_layers(), _output);
+                // Проверочный набор оценивается частями того же размера, что и пакеты
+                // обучения (части пакета при накоплении градиентов)
+                _val_chunk = buffer_cols;
+
+                if (resumed)
+                {
+                    // Продолжение с точки: состояние остановки и незавершенная проверка
+                    // восстанавливаются, чтобы решения совпали с непрерывным обучением
+                    if (_stopping) _stopping->set_state(_resume_stopping);
+
+                    _val_loss = _resume_val_loss;
+
+                    if (_resume_val_epoch >= 0) start_validation(_resume_val_epoch);
+                }
+                else if (_stopping)
+                {
+                    _stopping->reset();
+                }
+            }
+
             // Итерации по всему набору данных
-            for (int k = 0; k < epoch; k++)
+            for (int k = start_epoch; k < epoch; k++)
             {
                 _callback->_epoch_id = k;
 
                 // Тренируйтесь на каждой мини-партии
-                for (int i = 0; i < nbatch; i++)
+                for (int i = (k == start_epoch) ? start_batch : 0; i < nbatch; i++)
                 {
                     _callback->_batch_id = i;
                     _callback->pre_training_batch(this, x_batches[i], y_batches[i]);
-                    this->forward(x_batches[i]);
-                    this->backprop(x_batches[i], y_batches[i]);
-                    this->update(opt);
+                    timed_train_batch(opt, x_batches[i], y_batches[i]);
                     _callback->post_training_batch(this, x_batches[i], y_batches[i]);
+
+                    if (_checkpointer && _checkpointer->tick()) save_checkpoint(opt, k, i, batch_size);
+                }
+
+                if (_x_val)
+                {
+                    // Проверка предыдущей эпохи шла параллельно с этой
+                    if (collect_validation()) break;
+
+                    launch_validation(k);
+                }
+            }
+
+            if (_x_val)
+            {
+                collect_validation();
+
+                if (_stopping && !_stopping->best_parameters().empty())
+                {
+                    if (_stopping->best_parameters().size() != num_parameters())
+                        throw std::invalid_argument("[class Network]: Early stopping parameter size does not match");
+
+                    load_parameters(_stopping->best_parameters().data());
                 }
             }
 
             return true;
         }
 
+        /// Один шаг обучения на готовом пакете.
+        /// В отличие от fit() не сбрасывает оптимизатор и не перестраивает набор данных,
+        /// поэтому состояние оптимизатора и ГСЧ сохраняется между вызовами. Профиль
+        /// производительности (ядро, количество потоков) применяется, как в fit().
+        ///
+        /// \param opt Объект, наследуемый от класса Optimizer.
+        /// \param x   Предикторы. Каждый столбец представляет собой наблюдение.
+        /// \param y   Переменная ответа. Каждый столбец представляет собой наблюдение.
+        template <typename TargetType>
+        bool train_step(Optimizer& opt, const Matrix& x, const TargetType& y)
+        {
+            return online_step(opt, x, y, x, y);
+        }
+
+        /// Онлайн-обучение на новом окне потока данных.
+        /// Окно обрабатывается как один пакет; при заданном резервуаре к нему
+        /// добавляются `nreplay` случайных старых наблюдений, после чего окно
+        /// само попадает в резервуар. Оптимизатор не сбрасывается. Обратный
+        /// вызов получает новое окно без наблюдений из резервуара.
+        ///
+        /// \param opt     Объект, наследуемый от класса Optimizer.
+        /// \param x       Предикторы нового окна. Каждый столбец представляет собой наблюдение.
+        /// \param y       Переменная ответа нового окна.
+        /// \param replay  Резервуар для повторного использования, NULL - без него.
+        /// \param nreplay Количество наблюдений из резервуара в каждом шаге.
+        bool partial_fit(Optimizer& opt, const Matrix& x, const Matrix& y,
+                         ReplayReservoir* replay = NULL, int nreplay = 0)
+        {
+            if (x.cols() != y.cols())
+                throw std::invalid_argument("[class Network]: Input data X and Y have different numbers of observations");
+
+            // Окно, которое не поместится в резервуар, отклоняется до шага обучения,
+            // а не после того, как параметры уже обновлены
+            if (replay) replay->check_data(x, y);
+
+            bool res;
+
+            if (replay && nreplay > 0 && replay->size() > 0)
+            {
+                replay->mix(x, y, nreplay, _rng);
+                res = online_step(opt, x, y, replay->mixed_x(), replay->mixed_y());
+            }
+            else
+            {
+                res = online_step(opt, x, y, x, y);
+            }
+
+            if (replay) replay->add(x, y, _rng);
+
+            return res;
+        }
+
         /// Используйте подобранную модель, чтобы делать прогнозы
         ///
         /// \param x Предикторы. Каждый столбец представляет собой наблюдение.
@@ -263,8 +1114,35 @@ namespace NNE
         {
             if (num_layers() <= 0) return Matrix();
 
+            apply_tuning(true);
             this->forward(x);
             return _layers[num_layers() - 1]->output();
         }
+
+        /// Прогноз в заранее выделенную матрицу. Если размер `res` уже совпадает
+        /// с размером прогноза, память в куче не выделяется.
+        ///
+        /// \param x   Предикторы. Каждый столбец представляет собой наблюдение.
+        /// \param res Матрица для результата.
+        void predict(const Matrix& x, Matrix& res)
+        {
+            if (num_layers() <= 0) return;
+
+            apply_tuning(true);
+            this->forward(x);
+            res.resize(_layers[num_layers() - 1]->out_size(), x.cols());
+            res.noalias() = _layers[num_layers() - 1]->output();
+        }
     };
+
+    inline void Callback::push_record(const Network* net, int nobs)
+    {
+        TelemetryRecord rec;
+        rec.epoch = _epoch_id;
+        rec.batch = _batch_id;
+        rec.nobs = nobs;
+        rec.loss = net->loss();
+        rec.batch_time = _batch_time;
+        _telemetry->push(rec);
+    }
 }
\ No newline at end of file
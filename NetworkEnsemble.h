@@ -0,0 +1,381 @@
+#pragma once
+
+#include <vector>
+#include <stdexcept>
+#include <string>
+#include "InitScalar.h"
+#include "Utilities/RNG.h"
+#include "Utilities/Random.h"
+#include "Utilities/ThreadPool.h"
+#include "Network.h"
+#include "Layer/Dense.h"
+#include "Optimizer/SGD.h"
+#include "Output/Regression.h"
+
+namespace NNE
+{
+    /// Ансамбль из K сетей одинаковой топологии (цепочка слоев Dense с
+    /// выходом RegressionMSE), которые обучаются одним проходом по общему потоку данных.
+    ///
+    /// Параметры всех моделей хранятся в одном плоском блоке. Веса слоя - матрица
+    /// `in_size x (K * out_size)` внутри блока, за ней смещения `K * out_size`;
+    /// блок столбцов модели k непрерывен в памяти и совпадает с раскладкой
+    /// параметров Dense. Шаг SGD выполняется одной поэлементной операцией над всем
+    /// блоком со своей скоростью обучения для параметров каждой модели.
+    ///
+    /// Ограничения:
+    /// - Только выход RegressionMSE и оптимизатор SGD (set_optimizers() отклоняет
+    ///   другие оптимизаторы), так как обновление общее для всего блока.
+    /// - Одним GEMM считается только первый слой, вход которого общий для всех
+    ///   моделей. Следующие слои блочно-диагональны: в Eigen нет пакетного GEMM,
+    ///   а блочно-диагональное произведение делает в K раз больше операций,
+    ///   поэтому они считаются K малыми GEMM, распределенными по пулу потоков.
+    ///   Выигрыш перед K отдельными Network::fit() зависит от доли первого слоя в
+    ///   вычислениях и измеряется bench_ensemble.cpp, а не гарантируется.
+    template <typename Activation>
+    class NetworkEnsemble
+    {
+     private:
+        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+        typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+        typedef Eigen::Map<Matrix> MapMat;
+        typedef Eigen::Map<const Matrix> ConstMapMat;
+        typedef Eigen::Map<Vector> MapVec;
+        typedef Eigen::Map<const Vector> ConstMapVec;
+
+        const int           _nmodel;  // Количество моделей K
+        std::vector<int>    _units;   // Размеры слоев: вход, скрытые слои, выход
+        std::vector<int>    _offset;  // Начало весов слоя l в плоском блоке, _offset[nlayer] - размер блока
+        Vector              _param;   // Параметры всех слоев и моделей
+        Vector              _grad;    // Производные в той же раскладке
+        Vector              _lrate;   // Скорость обучения каждого параметра
+        Vector              _decay;   // Коэффициент затухания каждого параметра
+        std::vector<Matrix> _z;       // Линейные термины, (K * out_l) x nobs
+        std::vector<Matrix> _a;       // Выходы слоев, (K * out_l) x nobs
+        std::vector<Matrix> _din;     // Производные входов слоев, (K * in_l) x nobs
+        std::vector<Matrix> _pred_z;  // Линейные термины одной модели для predict(k)
+        std::vector<Matrix> _pred_a;  // Выходы слоев одной модели для predict(k)
+        Matrix              _dout;    // Производная функции потерь по выходу сети
+        Vector              _loss;    // Потери каждой модели на последнем пакете
+        RNG                 _rng;     // ГСЧ для перемешивания общего потока данных
+        ThreadPool*         _pool;    // Общий пул потоков, NULL - последовательное выполнение
+
+        int num_layers() const { return _units.size() - 1;}
+
+        int in_size(int l) const { return _units[l];}
+
+        int out_size(int l) const { return _units[l + 1];}
+
+        // Размер весов слоя l одной модели
+        int weight_size(int l) const { return in_size(l) * out_size(l);}
+
+        MapMat weight(int l) { return MapMat(_param.data() + _offset[l], in_size(l), _nmodel * out_size(l));}
+
+        ConstMapMat weight(int l) const
+        {
+            return ConstMapMat(_param.data() + _offset[l], in_size(l), _nmodel * out_size(l));
+        }
+
+        MapVec bias(int l) { return MapVec(_param.data() + _offset[l] + _nmodel * weight_size(l), _nmodel * out_size(l));}
+
+        ConstMapVec bias(int l) const
+        {
+            return ConstMapVec(_param.data() + _offset[l] + _nmodel * weight_size(l), _nmodel * out_size(l));
+        }
+
+        MapMat dw(int l) { return MapMat(_grad.data() + _offset[l], in_size(l), _nmodel * out_size(l));}
+
+        MapVec db(int l) { return MapVec(_grad.data() + _offset[l] + _nmodel * weight_size(l), _nmodel * out_size(l));}
+
+        // Заполнить параметры модели k в векторах `lrate` и `decay`
+        void set_model_rate(int k, const Scalar& lrate, const Scalar& decay)
+        {
+            for (int l = 0; l < num_layers(); l++)
+            {
+                const int nweight = weight_size(l);
+                const int nout = out_size(l);
+                const int bias_start = _offset[l] + _nmodel * nweight;
+                _lrate.segment(_offset[l] + k * nweight, nweight).setConstant(lrate);
+                _lrate.segment(bias_start + k * nout, nout).setConstant(lrate);
+                _decay.segment(_offset[l] + k * nweight, nweight).setConstant(decay);
+                _decay.segment(bias_start + k * nout, nout).setConstant(decay);
+            }
+        }
+
+        void check_input(const Matrix& input) const
+        {
+            if (input.rows() != in_size(0))
+                throw std::invalid_argument("[class NetworkEnsemble]: Input data have incorrect dimension");
+        }
+
+        void forward(const Matrix& input)
+        {
+            check_input(input);
+            const int nobs = input.cols();
+
+            for (int l = 0; l < num_layers(); l++)
+            {
+                const int nout = out_size(l);
+                const MapMat w = weight(l);
+                _z[l].resize(_nmodel * nout, nobs);
+                _a[l].resize(_nmodel * nout, nobs);
+
+                if (l == 0)
+                {
+                    // Вход общий: один GEMM для всех моделей
+                    _z[0].noalias() = w.transpose() * input;
+                }
+                else
+                {
+                    const int nin = in_size(l);
+                    internal::parallel_for(_pool, 0, _nmodel, 1, [&](int b, int e)
+                    {
+                        for (int k = b; k < e; k++)
+                            _z[l].middleRows(k * nout, nout).noalias() =
+                                w.middleCols(k * nout, nout).transpose() * _a[l - 1].middleRows(k * nin, nin);
+                    });
+                }
+
+                _z[l].colwise() += bias(l);
+                Activation::activate(_z[l], _a[l]);
+            }
+        }
+
+        void backprop(const Matrix& input, const Matrix& target)
+        {
+            const int nlayer = num_layers();
+            const int nobs = input.cols();
+            const int nvar = out_size(nlayer - 1);
+
+            if ((target.cols() != nobs) || (target.rows() != nvar))
+                throw std::invalid_argument("[class NetworkEnsemble]: Target data have incorrect dimension");
+
+            // L = 0.5 * ||yhat - y||^2, d(L) / d(yhat) = yhat - y
+            _dout.resize(_nmodel * nvar, nobs);
+            _loss.resize(_nmodel);
+
+            for (int k = 0; k < _nmodel; k++)
+            {
+                _dout.middleRows(k * nvar, nvar).noalias() = _a[nlayer - 1].middleRows(k * nvar, nvar) - target;
+                _loss[k] = _dout.middleRows(k * nvar, nvar).squaredNorm() / nobs * Scalar(0.5);
+            }
+
+            for (int l = nlayer - 1; l >= 0; l--)
+            {
+                const int nin = in_size(l);
+                const int nout = out_size(l);
+                const Matrix& next_layer_data = (l == nlayer - 1) ? _dout : _din[l + 1];
+                // dL/dz сохраняется поверх _z
+                Matrix& dLz = _z[l];
+                Activation::jacobian(_z[l], _a[l], next_layer_data, dLz);
+                db(l).noalias() = dLz.rowwise().mean();
+                MapMat dwl = dw(l);
+
+                if (l == 0)
+                {
+                    // Вход общий: один GEMM для производных весов всех моделей
+                    dwl.noalias() = input * dLz.transpose() / Scalar(nobs);
+                    continue;
+                }
+
+                const MapMat w = weight(l);
+                _din[l].resize(_nmodel * nin, nobs);
+                internal::parallel_for(_pool, 0, _nmodel, 1, [&](int b, int e)
+                {
+                    for (int k = b; k < e; k++)
+                    {
+                        dwl.middleCols(k * nout, nout).noalias() =
+                            _a[l - 1].middleRows(k * nin, nin) * dLz.middleRows(k * nout, nout).transpose() / Scalar(nobs);
+                        _din[l].middleRows(k * nin, nin).noalias() =
+                            w.middleCols(k * nout, nout) * dLz.middleRows(k * nout, nout);
+                    }
+                });
+            }
+        }
+
+        // Шаг SGD сразу для всех слоев и моделей: одна поэлементная операция над
+        // плоским блоком, куски которого распределяются по пулу потоков
+        void update()
+        {
+            internal::parallel_for(_pool, 0, int(_param.size()), 4096, [&](int b, int e)
+            {
+                const int n = e - b;
+                _param.segment(b, n) -= _lrate.segment(b, n).cwiseProduct(
+                    _grad.segment(b, n) + _decay.segment(b, n).cwiseProduct(_param.segment(b, n)));
+            });
+        }
+
+     public:
+        /// \param nmodel Количество моделей в ансамбле.
+        /// \param units  Размеры слоев: размер входа, затем выходные размеры каждого слоя Dense.
+        NetworkEnsemble(int nmodel, const std::vector<int>& units) :
+            _nmodel(nmodel), _units(units), _rng(1), _pool(NULL)
+        {
+            if (nmodel < 1 || units.size() < 2)
+                throw std::invalid_argument("[class NetworkEnsemble]: Ensemble needs at least one model and one layer");
+
+            const int nlayer = num_layers();
+            _offset.resize(nlayer + 1);
+            _offset[0] = 0;
+
+            for (int l = 0; l < nlayer; l++)
+                _offset[l + 1] = _offset[l] + _nmodel * (weight_size(l) + out_size(l));
+
+            _param.resize(_offset[nlayer]);
+            _grad.resize(_offset[nlayer]);
+            _lrate.setConstant(_offset[nlayer], Scalar(0.001));
+            _decay.setZero(_offset[nlayer]);
+            _z.resize(nlayer);
+            _a.resize(nlayer);
+            _din.resize(nlayer);
+            _pred_z.resize(nlayer);
+            _pred_a.resize(nlayer);
+        }
+
+        /// Количество моделей в ансамбле
+        int num_models() const { return _nmodel;}
+
+        /// Задать общий пул потоков
+        void set_thread_pool(ThreadPool* pool) { _pool = pool;}
+
+        /// Задать скорость обучения каждой модели (шаг SGD)
+        /// \param lrate Вектор длины K со скоростями обучения.
+        /// \param decay Коэффициент затухания весов, общий для всех моделей.
+        void set_learning_rates(const std::vector<Scalar>& lrate, const Scalar& decay = Scalar(0))
+        {
+            if (static_cast<int>(lrate.size()) != _nmodel)
+                throw std::invalid_argument("[class NetworkEnsemble]: Learning rate size does not match");
+
+            for (int k = 0; k < _nmodel; k++) set_model_rate(k, lrate[k], decay);
+        }
+
+        /// Задать оптимизатор каждой модели, как в Network::fit().
+        /// Поддерживается только SGD: берутся его скорость обучения и затухание весов.
+        /// \param opt Вектор длины K с оптимизаторами моделей.
+        void set_optimizers(const std::vector<const Optimizer*>& opt)
+        {
+            if (static_cast<int>(opt.size()) != _nmodel)
+                throw std::invalid_argument("[class NetworkEnsemble]: Optimizer size does not match");
+
+            for (int k = 0; k < _nmodel; k++)
+            {
+                if (dynamic_cast<const SGD*>(opt[k]) == NULL)
+                    throw std::invalid_argument("[class NetworkEnsemble]: Only SGD is supported, model " +
+                                                std::to_string(k) + " uses another optimizer");
+            }
+
+            for (int k = 0; k < _nmodel; k++)
+            {
+                const SGD* sgd = static_cast<const SGD*>(opt[k]);
+                set_model_rate(k, sgd->learning_rate(), sgd->decay());
+            }
+        }
+
+        /// Инициализировать параметры каждой модели своим начальным числом.
+        /// Модель k получает те же параметры, что и Network::init(mu, sigma, seeds[k])
+        /// для сети той же топологии.
+        void init(const std::vector<int>& seeds, const Scalar& mu = Scalar(0),
+                  const Scalar& sigma = Scalar(0.01))
+        {
+            if (static_cast<int>(seeds.size()) != _nmodel)
+                throw std::invalid_argument("[class NetworkEnsemble]: Seed size does not match");
+
+            for (int k = 0; k < _nmodel; k++)
+            {
+                RNG rng(seeds[k]);
+
+                for (int l = 0; l < num_layers(); l++)
+                {
+                    const int nout = out_size(l);
+                    internal::set_normal_random(weight(l).data() + k * weight_size(l), weight_size(l), rng, mu, sigma);
+                    internal::set_normal_random(bias(l).data() + k * nout, nout, rng, mu, sigma);
+                }
+            }
+        }
+
+        /// Обучить все модели на общем потоке данных
+        /// \param x          Предикторы. Каждый столбец представляет собой наблюдение.
+        /// \param y          Переменная ответа. Каждый столбец представляет собой наблюдение.
+        /// \param batch_size Размер мини-пакета.
+        /// \param epoch      Количество эпох обучения.
+        /// \param seed       Начальное число ГСЧ перемешивания, если `seed > 0`.
+        template <typename DerivedX, typename DerivedY>
+        bool fit(const Eigen::MatrixBase<DerivedX>& x, const Eigen::MatrixBase<DerivedY>& y,
+                 int batch_size, int epoch, int seed = -1)
+        {
+            if (seed > 0) _rng.seed(seed);
+
+            std::vector<Matrix> x_batches;
+            std::vector<Matrix> y_batches;
+            const int nbatch = internal::create_shuffled_batches(x, y, batch_size, _rng,
+                               x_batches, y_batches);
+
+            for (int k = 0; k < epoch; k++)
+            {
+                for (int i = 0; i < nbatch; i++)
+                {
+                    this->forward(x_batches[i]);
+                    this->backprop(x_batches[i], y_batches[i]);
+                    this->update();
+                }
+            }
+
+            return true;
+        }
+
+        /// Потери каждой модели на последнем обученном пакете
+        const Vector& losses() const { return _loss;}
+
+        /// Прогноз модели k. Прямой проход выполняется только по параметрам этой модели.
+        Matrix predict(int k, const Matrix& x)
+        {
+            if (k < 0 || k >= _nmodel)
+                throw std::invalid_argument("[class NetworkEnsemble]: Model index out of range");
+
+            check_input(x);
+            const int nlayer = num_layers();
+
+            for (int l = 0; l < nlayer; l++)
+            {
+                const int nout = out_size(l);
+                const Matrix& prev_layer_data = (l == 0) ? x : _pred_a[l - 1];
+                _pred_z[l].resize(nout, x.cols());
+                _pred_a[l].resize(nout, x.cols());
+                _pred_z[l].noalias() = weight(l).middleCols(k * nout, nout).transpose() * prev_layer_data;
+                _pred_z[l].colwise() += bias(l).segment(k * nout, nout);
+                Activation::activate(_pred_z[l], _pred_a[l]);
+            }
+
+            return _pred_a[nlayer - 1];
+        }
+
+        /// Экспортировать модель k как обычную сеть
+        /// \param k   Номер модели.
+        /// \param net Пустая сеть, в которую будут добавлены слои и выходной слой RegressionMSE.
+        void export_model(int k, Network& net) const
+        {
+            if (k < 0 || k >= _nmodel)
+                throw std::invalid_argument("[class NetworkEnsemble]: Model index out of range");
+
+            if (net.num_layers() > 0)
+                throw std::invalid_argument("[class NetworkEnsemble]: Target network is not empty");
+
+            std::vector< std::vector<Scalar> > param(num_layers());
+
+            for (int l = 0; l < num_layers(); l++)
+            {
+                const int nout = out_size(l);
+                const int nweight = weight_size(l);
+                const Scalar* w = weight(l).data() + k * nweight;
+                const Scalar* b = bias(l).data() + k * nout;
+                param[l].assign(w, w + nweight);
+                param[l].insert(param[l].end(), b, b + nout);
+                net.add_layer(new Dense<Activation>(in_size(l), nout));
+            }
+
+            net.set_output(new RegressionMSE());
+            net.init();
+            net.set_parameters(param);
+        }
+    };
+}
@@ -14,7 +14,7 @@ protected:
     typedef Vector::AlignedMapType AlignedMapVec;
 
 public:
-    ~Optimizer() = default;
+    virtual ~Optimizer() = default;
 
     /// Сбросьте оптимизатор, чтобы очистить всю историческую информацию
     virtual void reset() = 0;
@@ -29,5 +29,15 @@ public:
     /// \param vec  Ввод ,текущий вектор параметров. На выходе,
     ///             обновленные параметры.
     virtual void update(ConstAlignedMapVec& dvec, AlignedMapVec& vec) = 0;
+
+    /// Размер внутреннего состояния оптимизатора (например, моментов) в скалярах.
+    /// Используется контрольными точками; оптимизаторы без памяти возвращают 0.
+    virtual std::size_t state_size() const { return 0;}
+
+    /// Скопировать внутреннее состояние в `dest` без выделения памяти
+    virtual void copy_state(Scalar* dest) const {}
+
+    /// Восстановить внутреннее состояние из `src`, записанное copy_state()
+    virtual void load_state(const Scalar* src) {}
 };
 }
\ No newline at end of file
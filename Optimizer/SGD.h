@@ -16,6 +16,14 @@ public:
 
     ~SGD() = default;
 
+    /// Скорость обучения
+    const Scalar& learning_rate() const { return _lrate;}
+
+    /// Коэффициент затухания весов
+    const Scalar& decay() const { return _decay;}
+
+    void reset() override {}
+
     void update(ConstAlignedMapVec& dvec, AlignedMapVec& vec) override
     {
         vec.noalias() -= _lrate * (dvec + _decay * vec);
@@ -3,6 +3,7 @@
 #include "/home/dimka/Eigen/Core"
 #include <stdexcept>
 #include "InitScalar.h"
+#include "Utilities/Arena.h"
 
 namespace NNE
 {
@@ -17,13 +18,19 @@ class Output
         typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
         typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
         typedef Eigen::RowVectorXi IntegerVector;
+        typedef Eigen::Map<Matrix> MapMat;
+        typedef Eigen::Map<const Matrix> ConstMapMat;
+        typedef Eigen::Ref<const Matrix> ConstRefMat;
 
     public:
         virtual ~Output() {}
 
+        // Создать новый выходной слой того же типа с непривязанными буферами
+        virtual Output* clone() const = 0;
+
         // Проверьте формат целевых данных, например. в задачах классификации
         // целевые данные должны быть бинарными (либо 0, либо 1)
-        virtual void check_target_data(const Matrix& target) {}
+        virtual void check_target_data(const ConstRefMat& target) {}
 
         // Другой тип целевых данных, где каждый элемент является меткой класса.
         // Эта версия может оказаться непригодной для задач регрессии, поэтому по умолчанию
@@ -36,12 +43,12 @@ class Output
         // Комбинация прямого этапа и обратного этапа для выходного слоя
         // Вычисленная производная ввода должна храниться в этом слое и может быть извлечена с помощью
         // функция backprop_data()
-        virtual void evaluate(const Matrix& prev_layer_data, const Matrix& target) = 0;
+        virtual void evaluate(const ConstRefMat& prev_layer_data, const ConstRefMat& target) = 0;
 
         // Другой тип целевых данных, где каждый элемент является меткой класса.
         // Эта версия может оказаться непригодной для задач регрессии, поэтому по умолчанию
         // мы вызываем исключение
-        virtual void evaluate(const Matrix& prev_layer_data,
+        virtual void evaluate(const ConstRefMat& prev_layer_data,
                               const IntegerVector& target)
         {
             throw std::invalid_argument("[class Output]: This output type cannot take class labels as target data");
@@ -49,7 +56,13 @@ class Output
 
         // Производная входа этого слоя, которая также является производной
         // вывода предыдущего слоя
-        virtual const Matrix& backprop_data() const = 0;
+        virtual ConstMapMat backprop_data() const = 0;
+
+        // Размер в байтах промежуточных буферов для пакета из `max_batch` наблюдений
+        virtual std::size_t buffer_size(int nvar, int max_batch) const = 0;
+
+        // Разместить промежуточные буферы в арене, рассчитанной на `max_batch` наблюдений
+        virtual void bind_buffers(Arena& arena, int nvar, int max_batch) = 0;
 
         // Вернуть значение функции потерь после оценки
         // Можно предположить, что эта функция вызывается после вычисления(), так что она может использовать
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <new>
 #include "Output.h"
 #include "InitScalar.h"
 
@@ -15,11 +16,30 @@ class RegressionMSE final: public Output
         typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
         typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
 
-        Matrix m_din;  // Производная входа этого слоя.
-                       // Обратите внимание, что вход этого слоя также является выходом предыдущего слоя.
+        MapMat m_din;   // Производная входа этого слоя.
+                        // Обратите внимание, что вход этого слоя также является выходом предыдущего слоя.
+        int m_max_batch; // Количество столбцов, на которое рассчитан буфер m_din
 
     public:
-        void evaluate(const Matrix& prev_layer_data, const Matrix& target)
+        RegressionMSE() : m_din(NULL, 0, 0), m_max_batch(0) {}
+
+        Output* clone() const
+        {
+            return new RegressionMSE();
+        }
+
+        std::size_t buffer_size(int nvar, int max_batch) const
+        {
+            return Arena::aligned_size(std::size_t(nvar) * max_batch);
+        }
+
+        void bind_buffers(Arena& arena, int nvar, int max_batch)
+        {
+            new (&m_din) MapMat(arena.allocate(std::size_t(nvar) * max_batch), nvar, 0);
+            m_max_batch = max_batch;
+        }
+
+        void evaluate(const ConstRefMat& prev_layer_data, const ConstRefMat& target)
         {
             // Проверить размер
             const int nobs = prev_layer_data.cols();
@@ -30,17 +50,22 @@ class RegressionMSE final: public Output
                 throw std::invalid_argument("[class RegressionMSE]: Target data have incorrect dimension");
             }
 
+            if (nobs > m_max_batch)
+            {
+                throw std::invalid_argument("[class RegressionMSE]: Batch size exceeds reserved buffers");
+            }
+
             // Вычислите производную входа этого слоя
             // L = 0.5 * ||yhat - y||^2
             // in = yhat
             // d(L) / d(in) = yhat - y
-            m_din.resize(nvar, nobs);
+            new (&m_din) MapMat(m_din.data(), nvar, nobs);
             m_din.noalias() = prev_layer_data - target;
         }
 
-        const Matrix& backprop_data() const
+        ConstMapMat backprop_data() const
         {
-            return m_din;
+            return ConstMapMat(m_din.data(), m_din.rows(), m_din.cols());
         }
 
         Scalar loss() const
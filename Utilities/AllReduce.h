@@ -0,0 +1,758 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+#include <algorithm>
+#include <condition_variable>
+#include <utility>
+#include <stdexcept>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include "InitScalar.h"
+
+namespace NNE
+{
+
+/// Связь между процессами, обучающими копии одной сети.
+///
+/// Все процессы вызывают allreduce() в одном и том же порядке с буферами
+/// одного размера. После вызова буфер каждого процесса содержит поэлементную
+/// сумму буферов всех процессов, одинаковую во всех процессах до последнего бита.
+///
+class Communicator
+{
+public:
+    virtual ~Communicator() {}
+
+    /// Номер процесса, от 0 до size() - 1
+    virtual int rank() const = 0;
+
+    /// Количество процессов
+    virtual int size() const = 0;
+
+    /// Заменить `data` суммой буферов всех процессов
+    virtual void allreduce(Scalar* data, std::size_t n) = 0;
+};
+
+
+/// Allreduce через общую память POSIX для процессов на одной машине.
+///
+/// Каждый процесс копирует свою часть буфера в свою ячейку сегмента, затем
+/// процесс `r` суммирует `r`-й блок всех ячеек (reduce-scatter) и все процессы
+/// собирают готовые блоки (allgather). Синхронизация - барьер на атомарных
+/// переменных в том же сегменте, без системных вызовов в быстром пути.
+///
+/// Процесс 0 удаляет сегмент с тем же именем, оставшийся от аварийно
+/// завершенного запуска, создает новый и инициализирует заголовок; остальные
+/// процессы подключаются только к сегменту, создатель которого жив. Если
+/// процесс-участник завершился или барьер не пройден за `timeout` секунд,
+/// выбрасывается исключение; после этого объект использовать нельзя.
+///
+/// **ПРИМЕЧАНИЕ**: процесс 0 удаляет сегмент в деструкторе.
+///
+class ShmCommunicator final : public Communicator
+{
+private:
+    static_assert(ATOMIC_INT_LOCK_FREE == 2, "Shared memory barrier needs lock-free atomics");
+
+    enum { READY = 0x4E4E4531 };  // Заголовок инициализирован процессом 0
+
+    // Заголовок сегмента, за ним идут идентификаторы процессов и ячейки
+    struct Header
+    {
+        std::atomic<int> count;       // Процессов, дошедших до барьера
+        std::atomic<int> generation;  // Номер пройденного барьера
+        std::atomic<int> ready;       // READY после инициализации
+        int              creator;     // Идентификатор процесса 0
+    };
+
+    typedef std::chrono::steady_clock Clock;
+
+    const std::string _name;
+    const int         _rank;
+    const int         _size;
+    const std::size_t _capacity;  // Емкость ячейки процесса в скалярах
+    const int         _timeout;   // Время ожидания барьера в секундах, <= 0 - без ограничения
+    std::size_t       _bytes;     // Размер сегмента
+    void*             _mem;
+    Header*           _header;
+    std::atomic<int>* _pids;      // Идентификаторы процессов-участников
+    Scalar*           _slots;     // _size ячеек по _capacity скаляров
+
+    Scalar* slot(int r) const { return _slots + std::size_t(r) * _capacity;}
+
+    static std::size_t pid_table_size(int size)
+    {
+        return (sizeof(std::atomic<int>) * size + 63) / 64 * 64;
+    }
+
+    // Процесс существует и не является зомби (завершился, но еще не дождан родителем)
+    static bool alive(int pid)
+    {
+        if (pid <= 0 || (kill(pid, 0) != 0 && errno != EPERM)) return false;
+
+        char state = 0;
+        const std::string path = "/proc/" + std::to_string(pid) + "/stat";
+        std::FILE* file = std::fopen(path.c_str(), "r");
+
+        if (file)
+        {
+            // Формат: pid (имя) состояние ...; имя может содержать скобки
+            char buf[512];
+            const std::size_t n = std::fread(buf, 1, sizeof(buf) - 1, file);
+            buf[n] = 0;
+            const char* p = std::strrchr(buf, ')');
+            if (p && p[1] == ' ') state = p[2];
+            std::fclose(file);
+        }
+
+        return state != 'Z' && state != 'X';
+    }
+
+    void fail(const std::string& msg) const
+    {
+        throw std::runtime_error("[class ShmCommunicator]: " + msg + " (" + _name + ")");
+    }
+
+    // Отобразить открытый сегмент
+    void map(int fd)
+    {
+        _mem = mmap(NULL, _bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+        if (_mem == MAP_FAILED) return;
+
+        char* base = static_cast<char*>(_mem);
+        _header = reinterpret_cast<Header*>(base);
+        _pids = reinterpret_cast<std::atomic<int>*>(base + 64);
+        _slots = reinterpret_cast<Scalar*>(base + 64 + pid_table_size(_size));
+    }
+
+    void create()
+    {
+        // Сегмент прошлого запуска может хранить ненулевое состояние барьера
+        shm_unlink(_name.c_str());
+        const int fd = shm_open(_name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+
+        if (fd < 0) fail("Cannot create shared memory");
+
+        if (ftruncate(fd, _bytes) == 0) map(fd);
+
+        close(fd);
+
+        if (_mem == MAP_FAILED) fail("Cannot map shared memory");
+
+        _header->count.store(0, std::memory_order_relaxed);
+        _header->generation.store(0, std::memory_order_relaxed);
+        _header->creator = getpid();
+
+        for (int r = 0; r < _size; r++) _pids[r].store(0, std::memory_order_relaxed);
+
+        _header->ready.store(READY, std::memory_order_release);
+    }
+
+    void attach()
+    {
+        const Clock::time_point deadline = Clock::now() + std::chrono::seconds(_timeout > 0 ? _timeout : 60);
+
+        while (true)
+        {
+            const int fd = shm_open(_name.c_str(), O_RDWR, 0600);
+            struct stat st;
+
+            if (fd >= 0)
+            {
+                if (fstat(fd, &st) == 0 && std::size_t(st.st_size) == _bytes) map(fd);
+
+                close(fd);
+            }
+
+            // Сегмент аварийно завершенного запуска: его создатель уже не работает
+            if (_mem != MAP_FAILED)
+            {
+                if (_header->ready.load(std::memory_order_acquire) == READY && alive(_header->creator)) return;
+
+                munmap(_mem, _bytes);
+                _mem = MAP_FAILED;
+            }
+
+            if (Clock::now() > deadline) fail("Timed out waiting for rank 0 to create shared memory");
+
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+    }
+
+    void barrier()
+    {
+        const int gen = _header->generation.load(std::memory_order_acquire);
+
+        if (_header->count.fetch_add(1, std::memory_order_acq_rel) == _size - 1)
+        {
+            _header->count.store(0, std::memory_order_relaxed);
+            _header->generation.fetch_add(1, std::memory_order_release);
+            return;
+        }
+
+        const Clock::time_point deadline = Clock::now() + std::chrono::seconds(_timeout);
+
+        for (long spin = 0; _header->generation.load(std::memory_order_acquire) == gen; spin++)
+        {
+            if (spin < 1024) continue;
+
+            std::this_thread::yield();
+
+            // Медленный путь: раз в несколько тысяч итераций проверяем участников и время
+            if (spin % 4096 != 0) continue;
+
+            for (int r = 0; r < _size; r++)
+            {
+                const int pid = _pids[r].load(std::memory_order_relaxed);
+
+                if (pid != 0 && !alive(pid)) fail("Process of rank " + std::to_string(r) + " has exited");
+            }
+
+            if (_timeout > 0 && Clock::now() > deadline) fail("Barrier timed out");
+        }
+    }
+
+public:
+    /// \param name     Имя сегмента общей памяти, например "/nne_job42".
+    /// \param rank     Номер процесса.
+    /// \param size     Количество процессов.
+    /// \param capacity Емкость ячейки в скалярах; большие буферы обрабатываются по частям.
+    /// \param timeout  Время ожидания других процессов в секундах, `<= 0` - без ограничения
+    ///                 (ожидание создания сегмента все равно ограничено 60 секундами).
+    ShmCommunicator(const std::string& name, int rank, int size, std::size_t capacity = 1 << 20,
+                    int timeout = 60) :
+        _name(name), _rank(rank), _size(size), _capacity(capacity > 0 ? capacity : 1), _timeout(timeout),
+        _mem(MAP_FAILED), _header(NULL), _pids(NULL), _slots(NULL)
+    {
+        if (size < 1 || rank < 0 || rank >= size)
+            throw std::invalid_argument("[class ShmCommunicator]: Invalid rank or number of processes");
+
+        _bytes = 64 + pid_table_size(size) + sizeof(Scalar) * std::size_t(size) * _capacity;
+
+        if (rank == 0) create();
+        else attach();
+
+        _pids[rank].store(getpid(), std::memory_order_release);
+
+        try
+        {
+            // Все процессы отобразили сегмент
+            barrier();
+        }
+        catch (...)
+        {
+            munmap(_mem, _bytes);
+            if (rank == 0) shm_unlink(name.c_str());
+            throw;
+        }
+    }
+
+    ShmCommunicator(const ShmCommunicator&) = delete;
+    ShmCommunicator& operator=(const ShmCommunicator&) = delete;
+
+    ~ShmCommunicator()
+    {
+        try
+        {
+            barrier();
+        }
+        catch (...) {}
+
+        munmap(_mem, _bytes);
+
+        if (_rank == 0) shm_unlink(_name.c_str());
+    }
+
+    int rank() const { return _rank;}
+
+    int size() const { return _size;}
+
+    void allreduce(Scalar* data, std::size_t n)
+    {
+        if (_size == 1) return;
+
+        for (std::size_t start = 0; start < n; start += _capacity)
+        {
+            const std::size_t len = std::min(_capacity, n - start);
+            Scalar* part = data + start;
+            std::memcpy(slot(_rank), part, len * sizeof(Scalar));
+            barrier();
+            // Reduce-scatter: процесс суммирует свой блок всех ячеек в порядке номеров,
+            // поэтому результат не зависит от того, кто пришел первым
+            const std::size_t b = len * _rank / _size;
+            const std::size_t e = len * (_rank + 1) / _size;
+            Scalar* own = slot(_rank);
+
+            for (std::size_t i = b; i < e; i++)
+            {
+                Scalar sum = slot(0)[i];
+
+                for (int r = 1; r < _size; r++) sum += slot(r)[i];
+
+                own[i] = sum;
+            }
+
+            barrier();
+
+            // Allgather: блок `r` готов в ячейке процесса `r`
+            for (int r = 0; r < _size; r++)
+            {
+                const std::size_t rb = len * r / _size;
+                const std::size_t re = len * (r + 1) / _size;
+                std::memcpy(part + rb, slot(r) + rb, (re - rb) * sizeof(Scalar));
+            }
+
+            // Ячейки нельзя перезаписывать, пока все не прочитали
+            barrier();
+        }
+    }
+};
+
+
+/// Кольцевой allreduce через TCP.
+///
+/// Процесс `r` принимает соединение от процесса `r - 1` и подключается к
+/// процессу `r + 1` (по модулю size()) на порт `base_port + номер`. За
+/// `size() - 1` шагов reduce-scatter и `size() - 1` шагов allgather каждый
+/// процесс передает соседу около `2 * n` скаляров независимо от числа процессов.
+/// По умолчанию соединения принимаются только с 127.0.0.1, что удобно для тестов.
+/// При установке кольца соседи обмениваются номерами и количеством процессов,
+/// соединения с неверным приветствием отклоняются.
+///
+class TcpCommunicator final : public Communicator
+{
+private:
+    const int           _rank;
+    const int           _size;
+    const int           _timeout;  // Время ожидания соседей в секундах, <= 0 при обмене - без ограничения
+    int                 _next;  // Сокет к процессу rank + 1
+    int                 _prev;  // Сокет от процесса rank - 1
+    std::vector<Scalar> _recv;  // Принятый блок, память только растет
+
+    static void fail(const std::string& msg)
+    {
+        throw std::runtime_error("[class TcpCommunicator]: " + msg + ": " + std::strerror(errno));
+    }
+
+    static void set_options(int fd)
+    {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+
+    typedef std::chrono::steady_clock Clock;
+
+    enum { MAGIC = 0x4E4E4554 };  // Начало приветствия при установке кольца
+
+    // Оставшееся время в миллисекундах для poll()
+    static int remaining_ms(const Clock::time_point& deadline)
+    {
+        const long ms = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now()).count();
+        return ms > 0 ? int(std::min(ms, 1000000L)) : 0;
+    }
+
+    // Прочитать ровно `bytes` байт из блокирующего сокета до истечения срока
+    static bool read_exact(int fd, void* buf, std::size_t bytes, const Clock::time_point& deadline)
+    {
+        char* p = static_cast<char*>(buf);
+
+        while (bytes > 0)
+        {
+            pollfd pfd = {fd, POLLIN, 0};
+
+            if (poll(&pfd, 1, remaining_ms(deadline)) <= 0) return false;
+
+            const ssize_t k = recv(fd, p, bytes, 0);
+
+            if (k <= 0) return false;
+
+            p += k;
+            bytes -= k;
+        }
+
+        return true;
+    }
+
+    // Приветствие: признак, номер процесса, количество процессов, размер скаляра
+    void hello(std::int32_t* msg) const
+    {
+        msg[0] = MAGIC;
+        msg[1] = _rank;
+        msg[2] = _size;
+        msg[3] = sizeof(Scalar);
+    }
+
+    bool valid_hello(const std::int32_t* msg, int rank) const
+    {
+        return msg[0] == MAGIC && msg[1] == rank && msg[2] == _size && msg[3] == std::int32_t(sizeof(Scalar));
+    }
+
+    // Подключиться к процессу rank + 1 и представиться
+    void connect_next(const std::string& host, int port, const Clock::time_point& deadline)
+    {
+        addrinfo hints, *res = NULL;
+        std::memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+
+        if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &res) != 0)
+            throw std::runtime_error("[class TcpCommunicator]: Cannot resolve " + host);
+
+        // Сосед мог еще не начать слушать, повторяем попытки
+        while (_next < 0 && Clock::now() < deadline)
+        {
+            _next = socket(AF_INET, SOCK_STREAM, 0);
+
+            if (_next >= 0 && connect(_next, res->ai_addr, res->ai_addrlen) != 0)
+            {
+                close(_next);
+                _next = -1;
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+        }
+
+        freeaddrinfo(res);
+
+        if (_next < 0) fail("Cannot connect to " + host + ":" + std::to_string(port));
+
+        std::int32_t msg[4];
+        hello(msg);
+
+        if (send(_next, msg, sizeof(msg), MSG_NOSIGNAL) != ssize_t(sizeof(msg))) fail("Handshake failed");
+    }
+
+    // Принять соединение от процесса rank - 1. Соединения, не приславшие верное
+    // приветствие, закрываются, ожидание продолжается до истечения срока.
+    void accept_prev(int listener, const Clock::time_point& deadline)
+    {
+        const int prev_rank = (_rank + _size - 1) % _size;
+
+        while (_prev < 0)
+        {
+            pollfd pfd = {listener, POLLIN, 0};
+
+            if (poll(&pfd, 1, remaining_ms(deadline)) <= 0)
+                throw std::runtime_error("[class TcpCommunicator]: Timed out waiting for rank " +
+                                         std::to_string(prev_rank));
+
+            const int fd = accept(listener, NULL, NULL);
+
+            if (fd < 0) continue;
+
+            // Чужое соединение не должно занимать все время ожидания
+            const Clock::time_point hello_deadline = std::min(deadline, Clock::now() + std::chrono::seconds(2));
+            std::int32_t msg[4];
+
+            if (read_exact(fd, msg, sizeof(msg), hello_deadline) && valid_hello(msg, prev_rank))
+            {
+                hello(msg);
+
+                if (send(fd, msg, sizeof(msg), MSG_NOSIGNAL) == ssize_t(sizeof(msg)))
+                {
+                    _prev = fd;
+                    break;
+                }
+            }
+
+            close(fd);
+        }
+    }
+
+    // Одновременно отправить блок следующему процессу и принять блок от предыдущего;
+    // poll() исключает взаимную блокировку при заполненных буферах сокетов.
+    // Если за время ожидания не передано ни одного байта, сосед считается зависшим.
+    void exchange(const Scalar* send_buf, std::size_t nsend, Scalar* recv_buf, std::size_t nrecv)
+    {
+        const char* sp = reinterpret_cast<const char*>(send_buf);
+        char* rp = reinterpret_cast<char*>(recv_buf);
+        std::size_t sleft = nsend * sizeof(Scalar), rleft = nrecv * sizeof(Scalar);
+        Clock::time_point deadline = Clock::now() + std::chrono::seconds(_timeout);
+
+        while (sleft > 0 || rleft > 0)
+        {
+            pollfd fds[2] = {{_next, short(sleft > 0 ? POLLOUT : 0), 0},
+                             {_prev, short(rleft > 0 ? POLLIN : 0), 0}};
+            const int ready = poll(fds, 2, _timeout > 0 ? remaining_ms(deadline) : -1);
+
+            if (ready < 0)
+            {
+                if (errno == EINTR) continue;
+                fail("poll failed");
+            }
+
+            if (ready == 0)
+                throw std::runtime_error("[class TcpCommunicator]: Timed out exchanging data with rank " +
+                                         std::to_string(sleft > 0 ? (_rank + 1) % _size : (_rank + _size - 1) % _size));
+
+            const std::size_t before = sleft + rleft;
+
+            if (sleft > 0 && (fds[0].revents & (POLLOUT | POLLERR | POLLHUP)))
+            {
+                const ssize_t k = send(_next, sp, sleft, MSG_NOSIGNAL);
+
+                if (k < 0 && errno != EAGAIN && errno != EINTR) fail("send failed");
+                if (k > 0) { sp += k; sleft -= k;}
+            }
+
+            if (rleft > 0 && (fds[1].revents & (POLLIN | POLLERR | POLLHUP)))
+            {
+                const ssize_t k = recv(_prev, rp, rleft, 0);
+
+                if (k == 0) throw std::runtime_error("[class TcpCommunicator]: Peer closed the connection");
+                if (k < 0 && errno != EAGAIN && errno != EINTR) fail("recv failed");
+                if (k > 0) { rp += k; rleft -= k;}
+            }
+
+            if (sleft + rleft < before) deadline = Clock::now() + std::chrono::seconds(_timeout);
+        }
+    }
+
+public:
+    /// \param rank      Номер процесса.
+    /// \param size      Количество процессов.
+    /// \param base_port Процесс `r` слушает порт `base_port + r`.
+    /// \param next_host Адрес процесса `rank + 1`.
+    /// \param bind_host Адрес, на котором процесс принимает соединение от `rank - 1`.
+    ///                  По умолчанию только локальный; для нескольких машин укажите
+    ///                  адрес интерфейса, доступного соседу.
+    /// \param timeout   Время ожидания соседей в секундах при подключении и при обмене
+    ///                  данными в allreduce(). `<= 0` снимает ограничение при обмене.
+    TcpCommunicator(int rank, int size, int base_port, const std::string& next_host = "127.0.0.1",
+                    const std::string& bind_host = "127.0.0.1", int timeout = 60) :
+        _rank(rank), _size(size), _timeout(timeout), _next(-1), _prev(-1)
+    {
+        if (size < 1 || rank < 0 || rank >= size)
+            throw std::invalid_argument("[class TcpCommunicator]: Invalid rank or number of processes");
+
+        if (size == 1) return;
+
+        const Clock::time_point deadline = Clock::now() + std::chrono::seconds(timeout);
+        // Слушаем до подключения, чтобы соседи не ждали друг друга по кругу
+        const int listener = socket(AF_INET, SOCK_STREAM, 0);
+        int one = 1;
+        sockaddr_in addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(base_port + rank);
+
+        if (listener < 0 || inet_pton(AF_INET, bind_host.c_str(), &addr.sin_addr) != 1 ||
+                setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0 ||
+                bind(listener, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, 4) != 0)
+        {
+            if (listener >= 0) close(listener);
+            fail("Cannot listen on " + bind_host + ":" + std::to_string(base_port + rank));
+        }
+
+        try
+        {
+            connect_next(next_host, base_port + (rank + 1) % size, deadline);
+            accept_prev(listener, deadline);
+            // Сосед подтверждает свой номер после того, как принял наше соединение
+            std::int32_t reply[4];
+
+            if (!read_exact(_next, reply, sizeof(reply), deadline) || !valid_hello(reply, (rank + 1) % size))
+                throw std::runtime_error("[class TcpCommunicator]: Rank " + std::to_string((rank + 1) % size) +
+                                         " did not confirm the connection");
+        }
+        catch (...)
+        {
+            close(listener);
+            if (_next >= 0) close(_next);
+            if (_prev >= 0) close(_prev);
+            throw;
+        }
+
+        close(listener);
+        set_options(_next);
+        set_options(_prev);
+    }
+
+    TcpCommunicator(const TcpCommunicator&) = delete;
+    TcpCommunicator& operator=(const TcpCommunicator&) = delete;
+
+    ~TcpCommunicator()
+    {
+        if (_next >= 0) close(_next);
+        if (_prev >= 0) close(_prev);
+    }
+
+    int rank() const { return _rank;}
+
+    int size() const { return _size;}
+
+    void allreduce(Scalar* data, std::size_t n)
+    {
+        if (_size == 1 || n == 0) return;
+
+        const int p = _size;
+        // Начало блока `c`
+        auto begin = [n, p](int c) { return n * ((c % p + p) % p) / p;};
+        auto length = [n, p](int c) { c = (c % p + p) % p; return n * (c + 1) / p - n * c / p;};
+
+        if (_recv.size() < n / p + 1) _recv.resize(n / p + 1);
+
+        // Reduce-scatter: после шага `s` блок `rank - s - 1` содержит сумму `s + 2` процессов;
+        // в конце процесс владеет полной суммой блока `rank + 1`
+        for (int s = 0; s < p - 1; s++)
+        {
+            const int sc = _rank - s, rc = _rank - s - 1;
+            exchange(data + begin(sc), length(sc), _recv.data(), length(rc));
+            Scalar* dest = data + begin(rc);
+
+            for (std::size_t i = 0; i < length(rc); i++) dest[i] += _recv[i];
+        }
+
+        // Allgather: готовые блоки передаются по кругу без изменений
+        for (int s = 0; s < p - 1; s++)
+        {
+            const int sc = _rank + 1 - s, rc = _rank - s;
+            exchange(data + begin(sc), length(sc), data + begin(rc), length(rc));
+        }
+    }
+};
+
+
+/// Асинхронное усреднение градиентов по корзинам (buckets).
+///
+/// Градиенты всех слоев лежат в одном плоском буфере. Готовые диапазоны
+/// буфера передаются фоновому потоку, который усредняет их через
+/// Communicator, пока поток обучения продолжает обратное распространение
+/// по предыдущим слоям. Очередь имеет фиксированную емкость, поэтому в
+/// установившемся режиме память не выделяется.
+///
+class GradientSync
+{
+private:
+    typedef std::pair<std::size_t, std::size_t> Range;
+
+    Communicator*           _comm;
+    std::vector<Scalar>     _grad;     // Плоский буфер градиентов
+    std::vector<Range>      _queue;    // Переданные диапазоны [начало, конец)
+    std::size_t             _nqueued;  // Количество переданных диапазонов
+    std::size_t             _ndone;    // Количество усредненных диапазонов
+    bool                    _stop;
+    std::string             _error;    // Ошибка связи, передается в wait()
+    std::mutex              _mutex;
+    std::condition_variable _cv;
+    std::thread             _thread;
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        while (true)
+        {
+            _cv.wait(lock, [this] { return _stop || _ndone < _nqueued; });
+
+            if (_ndone == _nqueued) return;
+
+            const Range range = _queue[_ndone];
+            lock.unlock();
+
+            std::string error;
+
+            try
+            {
+                Scalar* data = _grad.data() + range.first;
+                const std::size_t n = range.second - range.first;
+                _comm->allreduce(data, n);
+                const Scalar scale = Scalar(1) / _comm->size();
+
+                for (std::size_t i = 0; i < n; i++) data[i] *= scale;
+            }
+            catch (const std::exception& e)
+            {
+                error = e.what();
+            }
+
+            lock.lock();
+
+            if (!error.empty()) _error = error;
+
+            _ndone++;
+            _cv.notify_all();
+        }
+    }
+
+public:
+    GradientSync(Communicator* comm) : _comm(comm), _nqueued(0), _ndone(0), _stop(false)
+    {
+        _thread = std::thread(&GradientSync::run, this);
+    }
+
+    GradientSync(const GradientSync&) = delete;
+    GradientSync& operator=(const GradientSync&) = delete;
+
+    ~GradientSync()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _cv.notify_all();
+        _thread.join();
+    }
+
+    Communicator* communicator() const { return _comm;}
+
+    /// Подготовить буфер на `n` градиентов и очередь на `max_ranges` диапазонов.
+    /// Вызывается только между шагами, когда очередь пуста.
+    void resize(std::size_t n, std::size_t max_ranges)
+    {
+        _grad.resize(n);
+        _queue.resize(max_ranges);
+    }
+
+    Scalar* data() { return _grad.data();}
+
+    /// Передать диапазон [begin, end) буфера на усреднение
+    void submit(std::size_t begin, std::size_t end)
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+
+            if (_nqueued == _queue.size())
+                throw std::logic_error("[class GradientSync]: Too many buckets in one step");
+
+            _queue[_nqueued++] = Range(begin, end);
+        }
+        _cv.notify_all();
+    }
+
+    /// Дождаться усреднения всех переданных диапазонов
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _cv.wait(lock, [this] { return _ndone == _nqueued; });
+        _ndone = _nqueued = 0;
+
+        if (!_error.empty())
+        {
+            const std::string error = _error;
+            _error.clear();
+            throw std::runtime_error(error);
+        }
+    }
+};
+
+}
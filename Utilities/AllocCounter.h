@@ -0,0 +1,62 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+/// Отладочный счетчик выделений памяти в куче.
+///
+/// Определите NNE_COUNT_ALLOCATIONS ровно в одной единице трансляции перед
+/// включением этого файла: тогда malloc/calloc/realloc (а через них и operator new,
+/// и выделения Eigen) будут подсчитываться. Поддерживается только glibc.
+/// Без макроса allocation_count() всегда возвращает 0.
+
+namespace NNE
+{
+namespace internal
+{
+inline std::atomic<long>& alloc_counter()
+{
+    static std::atomic<long> counter(0);
+    return counter;
+}
+
+}
+
+/// Количество выделений памяти в куче с момента запуска программы
+inline long allocation_count()
+{
+    return internal::alloc_counter().load(std::memory_order_relaxed);
+}
+
+}
+
+#ifdef NNE_COUNT_ALLOCATIONS
+#ifndef __GLIBC__
+#error "NNE_COUNT_ALLOCATIONS requires glibc"
+#endif
+
+extern "C"
+{
+void* __libc_malloc(std::size_t size);
+void* __libc_calloc(std::size_t n, std::size_t size);
+void* __libc_realloc(void* ptr, std::size_t size);
+
+void* malloc(std::size_t size) noexcept
+{
+    NNE::internal::alloc_counter().fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void* calloc(std::size_t n, std::size_t size) noexcept
+{
+    NNE::internal::alloc_counter().fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(n, size);
+}
+
+void* realloc(void* ptr, std::size_t size) noexcept
+{
+    NNE::internal::alloc_counter().fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+}
+#endif
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstddef>
+#include <stdexcept>
+#include "/home/dimka/Eigen/Core"
+#include "InitScalar.h"
+
+namespace NNE
+{
+
+/// Интерфейс распределителя памяти для буферов слоев.
+/// Пользователь может передать свою реализацию (пул, статическая память и т.д.).
+class Allocator
+{
+public:
+    virtual ~Allocator() {}
+
+    /// Выделить `bytes` байт, выровненных не хуже EIGEN_MAX_ALIGN_BYTES
+    virtual void* allocate(std::size_t bytes) = 0;
+
+    /// Освободить память, выделенную allocate()
+    virtual void deallocate(void* ptr) = 0;
+};
+
+/// Распределитель по умолчанию на основе выровненного malloc из Eigen
+class AlignedAllocator final : public Allocator
+{
+public:
+    void* allocate(std::size_t bytes) override
+    {
+        return Eigen::internal::aligned_malloc(bytes);
+    }
+
+    void deallocate(void* ptr) override
+    {
+        Eigen::internal::aligned_free(ptr);
+    }
+};
+
+/// Линейная арена для буферов слоев.
+///
+/// Память запрашивается у распределителя одним блоком при reserve() и затем
+/// раздается без обращений к куче. Арена рассчитывается на максимальный размер
+/// пакета, меньшие пакеты используют начало тех же буферов.
+class Arena
+{
+private:
+    static const std::size_t Align = 64;   // Выравнивание буферов, не меньше строки кэша
+
+    AlignedAllocator _default_allocator;
+    Allocator*       _allocator;  // Распределитель, предоставленный пользователем, иначе _default_allocator
+    char*            _data;       // Начало блока памяти
+    std::size_t      _capacity;   // Размер блока в байтах
+    std::size_t      _used;       // Занятая часть блока в байтах
+
+    void release()
+    {
+        if (_data) _allocator->deallocate(_data);
+        _data = NULL;
+        _capacity = 0;
+        _used = 0;
+    }
+
+public:
+    Arena() : _allocator(&_default_allocator), _data(NULL), _capacity(0), _used(0) {}
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    ~Arena() { release(); }
+
+    /// Количество байт, которое займет буфер из `n` скаляров с учетом выравнивания
+    static std::size_t aligned_size(std::size_t n)
+    {
+        return (n * sizeof(Scalar) + Align - 1) / Align * Align;
+    }
+
+    /// Задать распределитель памяти. Ранее выделенный блок освобождается,
+    /// поэтому буферы нужно привязать заново.
+    void set_allocator(Allocator* allocator)
+    {
+        release();
+        _allocator = allocator ? allocator : &_default_allocator;
+    }
+
+    /// Гарантировать блок не меньше `bytes` байт и освободить все буферы.
+    /// При увеличении блока ранее выданные указатели становятся недействительными.
+    void reserve(std::size_t bytes)
+    {
+        if (bytes > _capacity)
+        {
+            release();
+            _data = static_cast<char*>(_allocator->allocate(bytes));
+
+            if (_data == NULL) throw std::bad_alloc();
+
+            _capacity = bytes;
+        }
+
+        _used = 0;
+    }
+
+    /// Выделить буфер из `n` скаляров
+    Scalar* allocate(std::size_t n)
+    {
+        const std::size_t bytes = aligned_size(n);
+
+        if (_used + bytes > _capacity)
+            throw std::length_error("[class Arena]: Arena capacity exceeded");
+
+        Scalar* res = reinterpret_cast<Scalar*>(_data + _used);
+        _used += bytes;
+        return res;
+    }
+
+    /// Размер блока в байтах
+    std::size_t capacity() const { return _capacity;}
+};
+
+}
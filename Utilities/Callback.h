@@ -1,8 +1,8 @@
 #pragma once
 
-#include <iostream>
 #include "/home/dimka/Eigen/Core"
 #include "InitScalar.h"
+#include "Telemetry.h"
 
 namespace NNE
 {
@@ -10,7 +10,9 @@ namespace NNE
 class Network;
 class  Callback
 {
-    private:
+    friend class Network;
+
+    protected:
         typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
         typedef Eigen::RowVectorXi IntegerVector;
 
@@ -19,23 +21,35 @@ class  Callback
         int _nepoch{};   // Общее количество эпох (один прогон на всем наборе данных) в процессе обучения
         int _epoch_id{}; // Индекс текущей эпохи (0, 1, ..., _nepoch-1)
 
+        Telemetry* _telemetry;  // Канал телеметрии, NULL - без вывода
+        double     _batch_time{}; // Время шага обучения на текущем пакете в секундах, задается сетью
+
+        // Передать запись о пакете в канал телеметрии.
+        // Определена в Network.h, так как использует полный тип Network
+        void push_record(const Network* net, int nobs);
+
     public:
 
-        Callback();
-        ~Callback();
+        /// \param telemetry Канал телеметрии, в который передаются записи о пакетах.
+        ///                  По умолчанию обратный вызов ничего не выводит.
+        Callback(Telemetry* telemetry = NULL) : _telemetry(telemetry) {}
+        virtual ~Callback() {}
+
+        /// Задать канал телеметрии, NULL отключает вывод
+        void set_telemetry(Telemetry* telemetry) { _telemetry = telemetry;}
+
+        virtual void pre_training_batch(const Network* net, const Matrix& x, const Matrix& y) {}
+
+        virtual void pre_training_batch(const Network* net, const Matrix& x, const IntegerVector& y) {}
 
-        void post_training_batch(const Network* net, const Matrix& x, const Matrix& y)
+        virtual void post_training_batch(const Network* net, const Matrix& x, const Matrix& y)
         {
-            const Scalar loss = net->get_output()->loss();
-            std::cout << "[Epoch " << _epoch_id << ", batch " << _batch_id << "] Loss = "
-                      << loss << std::endl;
+            if (_telemetry) push_record(net, x.cols());
         }
 
-        void post_training_batch(const Network* net, const Matrix& x,const IntegerVector& y)
+        virtual void post_training_batch(const Network* net, const Matrix& x, const IntegerVector& y)
         {
-            Scalar loss = net->get_output()->loss();
-            std::cout << "[Epoch " << _epoch_id << ", batch " << _batch_id << "] Loss = "
-                      << loss << std::endl;
+            if (_telemetry) push_record(net, x.cols());
         }
 };
 
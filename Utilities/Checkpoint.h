@@ -0,0 +1,362 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <limits>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include "InitScalar.h"
+
+namespace NNE
+{
+
+/// Состояние политики ранней остановки
+struct StoppingState
+{
+    Scalar              best_loss;  // Наилучшие потери
+    int                 best_epoch; // Эпоха наилучших потерь, -1 - проверок не было
+    int                 wait;       // Проверок подряд без улучшения
+    std::vector<Scalar> best_param; // Параметры с наилучшими потерями
+
+    StoppingState() : best_loss(std::numeric_limits<Scalar>::infinity()), best_epoch(-1), wait(0) {}
+};
+
+/// Согласованный снимок состояния обучения
+struct Checkpoint
+{
+    std::vector<Scalar> param;      // Параметры всех слоев подряд
+    std::vector<Scalar> opt_state;  // Внутреннее состояние оптимизатора
+    unsigned long       rng_state;  // Состояние ГСЧ перед перемешиванием мини-пакетов
+    int                 epoch;      // Эпоха последнего обработанного пакета
+    int                 batch;      // Индекс последнего обработанного пакета
+    int                 batch_size; // Размер мини-пакета
+    int                 val_epoch;  // Эпоха снимка, проверка которого не завершена, -1 - нет
+    std::vector<Scalar> val_param;  // Параметры этого снимка
+    Scalar              val_loss;   // Потери последней завершенной проверки
+    StoppingState       stopping;   // Состояние ранней остановки
+
+    Checkpoint() : rng_state(0), epoch(0), batch(0), batch_size(0), val_epoch(-1),
+                   val_loss(std::numeric_limits<Scalar>::quiet_NaN()) {}
+};
+
+namespace internal
+{
+// Последний байт - версия формата. Версия 2 добавляет состояние проверки
+const char   checkpoint_magic[8] = {'N', 'N', 'E', 'C', 'K', 'P', 'T', '2'};
+
+// Запись без буферизации stdio: fopen() выделяет буфер в куче, а фоновая
+// запись контрольных точек не должна выделять память
+inline void write_raw(int fd, const void* data, std::size_t bytes)
+{
+    const char* p = static_cast<const char*>(data);
+
+    while (bytes > 0)
+    {
+        const ssize_t k = ::write(fd, p, bytes);
+
+        if (k < 0 && errno == EINTR) continue;
+
+        if (k <= 0) throw std::runtime_error("[function write_checkpoint]: Write failed");
+
+        p += k;
+        bytes -= k;
+    }
+}
+
+inline void read_raw(std::FILE* file, void* data, std::size_t bytes)
+{
+    if (bytes > 0 && std::fread(data, 1, bytes, file) != bytes)
+        throw std::runtime_error("[function read_checkpoint]: Unexpected end of file");
+}
+
+// Записать контрольную точку в двоичном формате. Данные пишутся во временный
+// файл `tmp`, который затем переименовывается, поэтому файл `filename` всегда цел.
+// Память в куче выделяется только при ошибке.
+inline void write_checkpoint(const std::string& filename, const std::string& tmp, const Checkpoint& ckpt)
+{
+    const int file = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (file < 0) throw std::runtime_error("[function write_checkpoint]: Cannot open file " + tmp);
+
+    try
+    {
+        const std::uint32_t scalar_size = sizeof(Scalar);
+        const std::uint64_t rng_state = ckpt.rng_state;
+        const std::int32_t  pos[3] = {ckpt.epoch, ckpt.batch, ckpt.batch_size};
+        const std::uint64_t nparam = ckpt.param.size();
+        const std::uint64_t nstate = ckpt.opt_state.size();
+        write_raw(file, checkpoint_magic, sizeof(checkpoint_magic));
+        write_raw(file, &scalar_size, sizeof(scalar_size));
+        write_raw(file, &rng_state, sizeof(rng_state));
+        write_raw(file, pos, sizeof(pos));
+        write_raw(file, &nparam, sizeof(nparam));
+        write_raw(file, ckpt.param.data(), nparam * sizeof(Scalar));
+        write_raw(file, &nstate, sizeof(nstate));
+        write_raw(file, ckpt.opt_state.data(), nstate * sizeof(Scalar));
+        const std::int32_t  val_pos[3] = {ckpt.val_epoch, ckpt.stopping.best_epoch, ckpt.stopping.wait};
+        const Scalar        losses[2] = {ckpt.val_loss, ckpt.stopping.best_loss};
+        const std::uint64_t nval = ckpt.val_param.size();
+        const std::uint64_t nbest = ckpt.stopping.best_param.size();
+        write_raw(file, val_pos, sizeof(val_pos));
+        write_raw(file, losses, sizeof(losses));
+        write_raw(file, &nval, sizeof(nval));
+        write_raw(file, ckpt.val_param.data(), nval * sizeof(Scalar));
+        write_raw(file, &nbest, sizeof(nbest));
+        write_raw(file, ckpt.stopping.best_param.data(), nbest * sizeof(Scalar));
+    }
+    catch (...)
+    {
+        ::close(file);
+        throw;
+    }
+
+    if (::close(file) != 0 || std::rename(tmp.c_str(), filename.c_str()) != 0)
+        throw std::runtime_error("[function write_checkpoint]: Cannot write file " + filename);
+}
+
+}
+
+/// Прочитать контрольную точку, записанную Checkpointer
+inline void load_checkpoint(const std::string& filename, Checkpoint& ckpt)
+{
+    std::FILE* file = std::fopen(filename.c_str(), "rb");
+
+    if (!file) throw std::runtime_error("[function load_checkpoint]: Cannot open file " + filename);
+
+    try
+    {
+        char magic[sizeof(internal::checkpoint_magic)];
+        std::uint32_t scalar_size;
+        std::uint64_t rng_state, nparam, nstate;
+        std::int32_t pos[3];
+        internal::read_raw(file, magic, sizeof(magic));
+        internal::read_raw(file, &scalar_size, sizeof(scalar_size));
+
+        // Версия 1 не содержит состояния проверки
+        const int version = magic[sizeof(magic) - 1] - '0';
+
+        if (std::memcmp(magic, internal::checkpoint_magic, sizeof(magic) - 1) != 0 ||
+                version < 1 || version > 2 || scalar_size != sizeof(Scalar))
+            throw std::runtime_error("[function load_checkpoint]: File is not a compatible checkpoint");
+
+        internal::read_raw(file, &rng_state, sizeof(rng_state));
+        internal::read_raw(file, pos, sizeof(pos));
+        internal::read_raw(file, &nparam, sizeof(nparam));
+        ckpt.param.resize(nparam);
+        internal::read_raw(file, ckpt.param.data(), nparam * sizeof(Scalar));
+        internal::read_raw(file, &nstate, sizeof(nstate));
+        ckpt.opt_state.resize(nstate);
+        internal::read_raw(file, ckpt.opt_state.data(), nstate * sizeof(Scalar));
+        ckpt.val_epoch = -1;
+        ckpt.val_param.clear();
+        ckpt.val_loss = std::numeric_limits<Scalar>::quiet_NaN();
+        ckpt.stopping = StoppingState();
+
+        if (version >= 2)
+        {
+            std::int32_t val_pos[3];
+            Scalar losses[2];
+            std::uint64_t nval, nbest;
+            internal::read_raw(file, val_pos, sizeof(val_pos));
+            internal::read_raw(file, losses, sizeof(losses));
+            internal::read_raw(file, &nval, sizeof(nval));
+            ckpt.val_param.resize(nval);
+            internal::read_raw(file, ckpt.val_param.data(), nval * sizeof(Scalar));
+            internal::read_raw(file, &nbest, sizeof(nbest));
+            ckpt.stopping.best_param.resize(nbest);
+            internal::read_raw(file, ckpt.stopping.best_param.data(), nbest * sizeof(Scalar));
+            ckpt.val_epoch = val_pos[0];
+            ckpt.stopping.best_epoch = val_pos[1];
+            ckpt.stopping.wait = val_pos[2];
+            ckpt.val_loss = losses[0];
+            ckpt.stopping.best_loss = losses[1];
+        }
+
+        ckpt.rng_state = rng_state;
+        ckpt.epoch = pos[0];
+        ckpt.batch = pos[1];
+        ckpt.batch_size = pos[2];
+    }
+    catch (...)
+    {
+        std::fclose(file);
+        throw;
+    }
+
+    std::fclose(file);
+}
+
+
+/// Неблокирующая запись контрольных точек.
+///
+/// Используются два буфера снимков. Поток обучения копирует параметры в
+/// свободный буфер (одно копирование памяти без выделений после reserve() или
+/// первого раза) и продолжает работу, а фоновый поток сериализует снимок на диск
+/// без выделений памяти. Если оба буфера заняты, необработанный снимок заменяется
+/// более новым.
+///
+class Checkpointer
+{
+private:
+    const std::string       _filename;
+    const std::string       _tmp_filename; // Временный файл записи
+    const int               _interval;   // Период контрольных точек в пакетах
+    int                     _counter;    // Пакетов с последней контрольной точки
+    Checkpoint              _slots[2];
+    int                     _writing;    // Буфер, который сейчас пишется, -1 - нет
+    int                     _pending;    // Буфер, ожидающий записи, -1 - нет
+    int                     _filling;    // Буфер, который заполняет поток обучения, -1 - нет
+    long                    _nwritten;   // Количество записанных контрольных точек
+    bool                    _stop;
+    std::string             _error;      // Сообщение о последней ошибке записи
+    std::mutex              _mutex;
+    std::condition_variable _cv;
+    std::thread             _thread;
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        while (true)
+        {
+            _cv.wait(lock, [this] { return _stop || _pending >= 0; });
+
+            if (_pending < 0) return;
+
+            _writing = _pending;
+            _pending = -1;
+            lock.unlock();
+
+            std::string error;
+
+            try
+            {
+                internal::write_checkpoint(_filename, _tmp_filename, _slots[_writing]);
+            }
+            catch (const std::exception& e)
+            {
+                error = e.what();
+            }
+
+            lock.lock();
+
+            if (error.empty()) _nwritten++;
+            else _error = error;
+
+            _writing = -1;
+            _cv.notify_all();
+        }
+    }
+
+public:
+    /// \param filename Файл контрольной точки.
+    /// \param interval Период контрольных точек в обработанных мини-пакетах.
+    Checkpointer(const std::string& filename, int interval) :
+        _filename(filename), _tmp_filename(filename + ".tmp"), _interval(interval > 0 ? interval : 1), _counter(0),
+        _writing(-1), _pending(-1), _filling(-1), _nwritten(0), _stop(false)
+    {
+        _thread = std::thread(&Checkpointer::run, this);
+    }
+
+    Checkpointer(const Checkpointer&) = delete;
+    Checkpointer& operator=(const Checkpointer&) = delete;
+
+    /// Деструктор дописывает ожидающий снимок и останавливает фоновый поток
+    ~Checkpointer()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+        }
+        _cv.notify_all();
+        _thread.join();
+    }
+
+    /// Отметить обработанный пакет
+    /// \return `true`, если пора сделать контрольную точку.
+    bool tick()
+    {
+        if (++_counter < _interval) return false;
+
+        _counter = 0;
+        return true;
+    }
+
+    /// Зарезервировать память обоих буферов снимков, чтобы контрольные точки
+    /// не выделяли память и в первый раз.
+    /// \param nparam Количество параметров сети.
+    /// \param nstate Размер состояния оптимизатора.
+    void reserve(std::size_t nparam, std::size_t nstate)
+    {
+        // Пишущийся буфер нельзя трогать, дожидаемся конца записи
+        wait();
+
+        for (int i = 0; i < 2; i++)
+        {
+            _slots[i].param.reserve(nparam);
+            _slots[i].opt_state.reserve(nstate);
+            _slots[i].val_param.reserve(nparam);
+            _slots[i].stopping.best_param.reserve(nparam);
+        }
+    }
+
+    /// Начать отсчет периода заново, как сразу после контрольной точки
+    void restart() { _counter = 0;}
+
+    /// Получить буфер для заполнения снимком. Никогда не ждет фоновой записи.
+    Checkpoint& acquire()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        // Занят не более чем один буфер (пишется), берем другой;
+        // ожидающий записи снимок будет заменен новым
+        _filling = (_writing == 0) ? 1 : 0;
+
+        if (_pending == _filling) _pending = -1;
+
+        return _slots[_filling];
+    }
+
+    /// Передать заполненный буфер фоновому потоку для записи
+    void commit()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _pending = _filling;
+            _filling = -1;
+        }
+        _cv.notify_all();
+    }
+
+    /// Дождаться записи всех переданных снимков
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _cv.wait(lock, [this] { return _pending < 0 && _writing < 0; });
+    }
+
+    /// Количество успешно записанных контрольных точек
+    long num_written()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _nwritten;
+    }
+
+    /// Сообщение о последней ошибке записи, пустая строка если ошибок не было
+    std::string error()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _error;
+    }
+
+    const std::string& filename() const { return _filename;}
+};
+
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <string>
+#include <stdexcept>
+
+namespace NNE
+{
+namespace internal
+{
+// Числовые идентификаторы типов слоев и функций активации,
+// используются в метаинформации для экспорта модели
+enum LAYER_ENUM
+{
+    DENSE = 0
+};
+
+inline int layer_id(const std::string& type)
+{
+    if (type == "Dense") return DENSE;
+
+    throw std::invalid_argument("[function layer_id]: Layer is not of a known type");
+    return -1;
+}
+
+enum ACTIVATION_ENUM
+{
+    RELU = 0
+};
+
+inline int activation_id(const std::string& type)
+{
+    if (type == "ReLU") return RELU;
+
+    throw std::invalid_argument("[function activation_id]: Activation is not of a known type");
+    return -1;
+}
+
+// Варианты ядра умножения матриц в слоях
+enum KERNEL_ENUM
+{
+    KERNEL_BLOCKED = 0,  // Блочный GEMM Eigen, выгоден для больших матриц
+    KERNEL_LAZY    = 1   // Покомпонентное произведение без блокировки, выгодно для малых матриц
+};
+
+}
+}
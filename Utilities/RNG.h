@@ -48,6 +48,13 @@ public:
         _rand = (seed ? (seed & _max) : 1);
     }
 
+    /// Текущее состояние генератора. seed(state()) восстанавливает
+    /// ту же последовательность чисел.
+    virtual unsigned long state() const
+    {
+        return _rand;
+    }
+
     virtual Scalar rand()
     {
         _rand = long_rand(_rand);
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <stdexcept>
+#include "/home/dimka/Eigen/Core"
+#include "InitScalar.h"
+#include "RNG.h"
+
+namespace NNE
+{
+
+/// Ограниченный резервуар наблюдений для повторного использования (replay)
+/// при онлайн-обучении.
+///
+/// Резервуар хранит равномерную выборку из всех поступивших наблюдений
+/// (алгоритм R), вся память выделяется в конструкторе. Новый пакет можно
+/// смешать с наблюдениями из резервуара, чтобы модель отслеживала дрейф
+/// данных и не забывала старые.
+///
+class ReplayReservoir
+{
+private:
+    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+
+    Matrix _x;      // Сохраненные предикторы, dimx x capacity
+    Matrix _y;      // Сохраненные ответы, dimy x capacity
+    int    _size;   // Количество сохраненных наблюдений
+    long   _seen;   // Количество наблюдений, поступивших с начала работы
+    Matrix _x_mix;  // Смешанный пакет: новые наблюдения и наблюдения из резервуара
+    Matrix _y_mix;
+    int    _nmix;   // Количество наблюдений в смешанном пакете
+
+public:
+    /// \param capacity Максимальное количество хранимых наблюдений.
+    /// \param dimx     Размерность предикторов.
+    /// \param dimy     Размерность переменной ответа.
+    ReplayReservoir(int capacity, int dimx, int dimy) :
+        _x(dimx, capacity), _y(dimy, capacity), _size(0), _seen(0), _nmix(0)
+    {
+        if (capacity < 1)
+            throw std::invalid_argument("[class ReplayReservoir]: Capacity must be positive");
+    }
+
+    /// Количество сохраненных наблюдений
+    int size() const { return _size;}
+
+    /// Максимальное количество хранимых наблюдений
+    int capacity() const { return _x.cols();}
+
+    /// Проверить, что размерности наблюдений совпадают с размерностями резервуара
+    void check_data(const Matrix& x, const Matrix& y) const
+    {
+        if (x.rows() != _x.rows() || y.rows() != _y.rows() || x.cols() != y.cols())
+            throw std::invalid_argument("[class ReplayReservoir]: Data have incorrect dimension");
+    }
+
+    /// Добавить наблюдения в резервуар
+    void add(const Matrix& x, const Matrix& y, RNG& rng)
+    {
+        check_data(x, y);
+
+        for (int j = 0; j < x.cols(); j++)
+        {
+            _seen++;
+            int pos = _size;
+
+            // Резервуар заполнен: наблюдение заменяет случайное с вероятностью capacity / seen
+            if (_size == capacity())
+            {
+                const long r = long(rng.rand() * _seen);
+                if (r >= capacity()) continue;
+                pos = int(r);
+            }
+            else
+            {
+                _size++;
+            }
+
+            _x.col(pos).noalias() = x.col(j);
+            _y.col(pos).noalias() = y.col(j);
+        }
+    }
+
+    /// Составить пакет из новых наблюдений и `nreplay` случайных наблюдений из резервуара.
+    /// Результат доступен через mixed_x() и mixed_y(). Буферы рассчитываются на окно и
+    /// весь резервуар сразу, поэтому память выделяется только при первом вызове и при
+    /// увеличении окна, а не по мере заполнения резервуара.
+    void mix(const Matrix& x, const Matrix& y, int nreplay, RNG& rng)
+    {
+        check_data(x, y);
+
+        if (nreplay > _size) nreplay = _size;
+
+        const int nobs = x.cols();
+
+        if (_x_mix.cols() < nobs + nreplay)
+        {
+            _x_mix.resize(_x.rows(), nobs + capacity());
+            _y_mix.resize(_y.rows(), nobs + capacity());
+        }
+
+        _nmix = nobs + nreplay;
+        _x_mix.leftCols(nobs).noalias() = x;
+        _y_mix.leftCols(nobs).noalias() = y;
+
+        for (int j = 0; j < nreplay; j++)
+        {
+            const int id = int(rng.rand() * _size) % _size;
+            _x_mix.col(nobs + j).noalias() = _x.col(id);
+            _y_mix.col(nobs + j).noalias() = _y.col(id);
+        }
+    }
+
+    /// Сохраненные предикторы, по столбцу на наблюдение
+    Eigen::Ref<const Matrix> stored_x() const { return _x.leftCols(_size);}
+
+    /// Сохраненные ответы
+    Eigen::Ref<const Matrix> stored_y() const { return _y.leftCols(_size);}
+
+    /// Предикторы смешанного пакета, блок буфера без копирования
+    Eigen::Ref<const Matrix> mixed_x() const { return _x_mix.leftCols(_nmix);}
+
+    /// Переменная ответа смешанного пакета
+    Eigen::Ref<const Matrix> mixed_y() const { return _y_mix.leftCols(_nmix);}
+};
+
+}
@@ -0,0 +1,264 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include "InitScalar.h"
+
+namespace NNE
+{
+
+/// Запись о мини-пакете, которую поток обучения передает в канал телеметрии
+struct TelemetryRecord
+{
+    int    epoch;       // Индекс эпохи
+    int    batch;       // Индекс мини-пакета в эпохе
+    int    nobs;        // Количество наблюдений в пакете
+    Scalar loss;        // Значение функции потерь на пакете
+    double batch_time;  // Время обработки пакета в секундах
+};
+
+/// Сводка по записям, накопленным за один интервал вывода
+struct TelemetrySummary
+{
+    int    epoch;       // Эпоха последней записи
+    int    batch;       // Мини-пакет последней записи
+    int    nbatch;      // Количество пакетов за интервал
+    Scalar last_loss;   // Потери на последнем пакете
+    Scalar mean_loss;   // Средние потери за интервал
+    double batch_time;  // Среднее время пакета в секундах
+    double throughput;  // Наблюдений в секунду
+    long   dropped;     // Записей потеряно из-за переполнения буфера с начала работы
+};
+
+namespace internal
+{
+// Кольцевой буфер без блокировок для одного производителя и одного потребителя.
+// Память выделяется один раз в конструкторе.
+template <typename T>
+class RingBuffer
+{
+private:
+    std::vector<T>           _buf;
+    const std::size_t        _mask;
+    std::atomic<std::size_t> _head;  // Следующая позиция чтения, меняет только потребитель
+    std::atomic<std::size_t> _tail;  // Следующая позиция записи, меняет только производитель
+
+    static std::size_t round_up(std::size_t n)
+    {
+        std::size_t res = 2;
+        while (res < n) res <<= 1;
+        return res;
+    }
+
+public:
+    RingBuffer(std::size_t capacity) :
+        _buf(round_up(capacity)), _mask(_buf.size() - 1), _head(0), _tail(0)
+    {}
+
+    bool push(const T& item)
+    {
+        const std::size_t tail = _tail.load(std::memory_order_relaxed);
+
+        if (tail - _head.load(std::memory_order_acquire) >= _buf.size()) return false;
+
+        _buf[tail & _mask] = item;
+        _tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& item)
+    {
+        const std::size_t head = _head.load(std::memory_order_relaxed);
+
+        if (head == _tail.load(std::memory_order_acquire)) return false;
+
+        item = _buf[head & _mask];
+        _head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+}
+
+
+/// Интерфейс приемника сводок телеметрии. Методы вызываются только из фонового потока.
+class TelemetrySink
+{
+public:
+    virtual ~TelemetrySink() {}
+
+    virtual void write(const TelemetrySummary& summary) = 0;
+};
+
+/// Вывод сводок в консоль или другой поток вывода
+class ConsoleSink final : public TelemetrySink
+{
+private:
+    std::ostream& _os;
+
+public:
+    ConsoleSink(std::ostream& os = std::cout) : _os(os) {}
+
+    void write(const TelemetrySummary& s) override
+    {
+        _os << "[Epoch " << s.epoch << ", batch " << s.batch << "] Loss = " << s.last_loss
+            << ", mean loss = " << s.mean_loss << ", " << s.throughput << " obs/s";
+
+        if (s.dropped > 0) _os << ", dropped " << s.dropped;
+
+        _os << std::endl;
+    }
+};
+
+/// Вывод сводок в CSV-файл
+class CsvSink final : public TelemetrySink
+{
+private:
+    std::ofstream _os;
+
+public:
+    CsvSink(const std::string& filename) : _os(filename.c_str())
+    {
+        if (!_os) throw std::invalid_argument("[class CsvSink]: Cannot open file " + filename);
+
+        _os << "epoch,batch,nbatch,last_loss,mean_loss,batch_time,throughput,dropped\n";
+    }
+
+    void write(const TelemetrySummary& s) override
+    {
+        _os << s.epoch << ',' << s.batch << ',' << s.nbatch << ',' << s.last_loss << ','
+            << s.mean_loss << ',' << s.batch_time << ',' << s.throughput << ',' << s.dropped << '\n';
+        _os.flush();
+    }
+};
+
+/// Вывод сводок в файл в формате JSON Lines (один объект на строку)
+class JsonLinesSink final : public TelemetrySink
+{
+private:
+    std::ofstream _os;
+
+public:
+    JsonLinesSink(const std::string& filename) : _os(filename.c_str())
+    {
+        if (!_os) throw std::invalid_argument("[class JsonLinesSink]: Cannot open file " + filename);
+    }
+
+    void write(const TelemetrySummary& s) override
+    {
+        _os << "{\"epoch\":" << s.epoch << ",\"batch\":" << s.batch << ",\"nbatch\":" << s.nbatch
+            << ",\"last_loss\":" << s.last_loss << ",\"mean_loss\":" << s.mean_loss
+            << ",\"batch_time\":" << s.batch_time << ",\"throughput\":" << s.throughput
+            << ",\"dropped\":" << s.dropped << "}\n";
+        _os.flush();
+    }
+};
+
+
+/// Асинхронный канал телеметрии обучения.
+///
+/// Поток обучения кладет записи фиксированного размера в кольцевой буфер без
+/// блокировок и системных вызовов. Фоновый поток с заданной периодичностью
+/// забирает записи, сводит их и передает приемнику. Если буфер переполнен,
+/// запись отбрасывается, а счетчик потерь увеличивается: обучение никогда не ждет вывода.
+///
+class Telemetry
+{
+private:
+    TelemetrySink&                    _sink;
+    internal::RingBuffer<TelemetryRecord> _ring;
+    const std::chrono::duration<double> _interval;  // Период вывода
+    std::atomic<long>                 _dropped;   // Количество отброшенных записей
+    std::atomic<bool>                 _stop;
+    std::mutex                        _mutex;
+    std::condition_variable           _cv;
+    std::thread                       _thread;
+
+    // Забрать все записи из буфера и передать сводку приемнику
+    void drain()
+    {
+        TelemetryRecord rec;
+        TelemetrySummary summary = TelemetrySummary();
+        double loss_sum = 0, time_sum = 0;
+        long nobs = 0;
+
+        while (_ring.pop(rec))
+        {
+            summary.epoch = rec.epoch;
+            summary.batch = rec.batch;
+            summary.last_loss = rec.loss;
+            summary.nbatch++;
+            loss_sum += rec.loss;
+            time_sum += rec.batch_time;
+            nobs += rec.nobs;
+        }
+
+        if (summary.nbatch == 0) return;
+
+        summary.mean_loss = Scalar(loss_sum / summary.nbatch);
+        summary.batch_time = time_sum / summary.nbatch;
+        summary.throughput = (time_sum > 0) ? nobs / time_sum : 0;
+        summary.dropped = _dropped.load(std::memory_order_relaxed);
+        _sink.write(summary);
+    }
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        while (!_stop.load(std::memory_order_acquire))
+        {
+            _cv.wait_for(lock, _interval);
+            drain();
+        }
+
+        drain();
+    }
+
+public:
+    /// \param sink     Приемник сводок.
+    /// \param interval Период вывода в секундах.
+    /// \param capacity Емкость кольцевого буфера в записях.
+    Telemetry(TelemetrySink& sink, double interval = 1.0, std::size_t capacity = 4096) :
+        _sink(sink), _ring(capacity), _interval(interval), _dropped(0), _stop(false)
+    {
+        _thread = std::thread(&Telemetry::run, this);
+    }
+
+    Telemetry(const Telemetry&) = delete;
+    Telemetry& operator=(const Telemetry&) = delete;
+
+    /// Деструктор выводит оставшиеся записи и останавливает фоновый поток
+    ~Telemetry()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop.store(true, std::memory_order_release);
+        }
+        _cv.notify_one();
+        _thread.join();
+    }
+
+    /// Передать запись. Вызывается только из одного потока (потока обучения).
+    /// \return `false`, если буфер переполнен и запись отброшена.
+    bool push(const TelemetryRecord& rec)
+    {
+        if (_ring.push(rec)) return true;
+
+        _dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    /// Количество отброшенных записей
+    long dropped() const { return _dropped.load(std::memory_order_relaxed);}
+};
+
+}
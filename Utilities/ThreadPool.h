@@ -0,0 +1,459 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include "/home/dimka/Eigen/Core"
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace NNE
+{
+namespace internal
+{
+// Число потоков Eigen сохраняется при создании первого живого пула и
+// восстанавливается при удалении последнего, в каком бы порядке ни удалялись пулы
+struct EigenThreadState
+{
+    std::mutex mutex;
+    int        npool = 0;  // Количество живых пулов в процессе
+    int        saved = 0;  // Число потоков Eigen до создания первого из них
+};
+
+inline EigenThreadState& eigen_thread_state()
+{
+    static EigenThreadState state;
+    return state;
+}
+
+inline void acquire_eigen_threads()
+{
+    EigenThreadState& state = eigen_thread_state();
+    std::lock_guard<std::mutex> lock(state.mutex);
+
+    if (state.npool++ == 0) state.saved = Eigen::nbThreads();
+
+    // Параллелизмом управляет пул, а не OpenMP внутри Eigen
+    Eigen::setNbThreads(1);
+}
+
+inline void release_eigen_threads()
+{
+    EigenThreadState& state = eigen_thread_state();
+    std::lock_guard<std::mutex> lock(state.mutex);
+
+    if (--state.npool == 0) Eigen::setNbThreads(state.saved);
+}
+
+}
+
+/// Общий пул потоков с перехватом работы (work stealing).
+///
+/// У каждого рабочего потока своя очередь: поток берет задачи с конца своей
+/// очереди, а при ее опустошении ворует задачи с начала чужих очередей.
+/// Пул используется как для параллельных циклов внутри слоя (intra-op),
+/// так и для фоновых задач сети (inter-op). Пока существует хотя бы один пул, внутренние
+/// потоки Eigen отключаются, чтобы не было переподписки ядер.
+///
+class ThreadPool
+{
+private:
+    typedef std::function<void()> Task;
+
+    // Кольцевая очередь задач. В отличие от std::deque не освобождает и не
+    // выделяет память в установившемся режиме, буфер только растет. Начальный
+    // буфер выделяется сразу: первая задача может попасть в очередь рабочего
+    // потока сколь угодно поздно, например фоновая проверка после нескольких эпох.
+    class TaskQueue
+    {
+    private:
+        std::vector<Task> _buf;
+        std::size_t       _head;
+        std::size_t       _size;
+
+        void grow()
+        {
+            std::vector<Task> buf(std::max<std::size_t>(16, _buf.size() * 2));
+
+            for (std::size_t i = 0; i < _size; i++) buf[i] = std::move(_buf[(_head + i) % _buf.size()]);
+
+            _buf.swap(buf);
+            _head = 0;
+        }
+
+    public:
+        TaskQueue() : _buf(16), _head(0), _size(0) {}
+
+        bool empty() const { return _size == 0;}
+
+        void push_back(Task&& task)
+        {
+            if (_size == _buf.size()) grow();
+
+            _buf[(_head + _size) % _buf.size()] = std::move(task);
+            _size++;
+        }
+
+        void pop_back(Task& task)
+        {
+            _size--;
+            task = std::move(_buf[(_head + _size) % _buf.size()]);
+        }
+
+        void pop_front(Task& task)
+        {
+            task = std::move(_buf[_head]);
+            _head = (_head + 1) % _buf.size();
+            _size--;
+        }
+    };
+
+    struct Worker
+    {
+        std::mutex mutex;
+        TaskQueue  tasks;
+    };
+
+    // Общее состояние параллельного цикла. Задачи захватывают только указатель
+    // на него и номер куска, поэтому std::function не выделяет память.
+    template <typename Function>
+    struct ForJob
+    {
+        const Function&    func;
+        const int          begin;
+        const int          end;
+        const int          chunk;
+        std::atomic<int>   remaining;
+        std::exception_ptr error;
+        std::mutex         error_mutex;
+
+        ForJob(const Function& f, int b, int e, int c, int nchunk) :
+            func(f), begin(b), end(e), chunk(c), remaining(nchunk)
+        {}
+
+        void run(int i)
+        {
+            const int b = begin + i * chunk;
+
+            try
+            {
+                func(b, std::min(end, b + chunk));
+            }
+            catch (...)
+            {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                error = std::current_exception();
+            }
+
+            remaining.fetch_sub(1, std::memory_order_release);
+        }
+    };
+
+    std::vector<std::unique_ptr<Worker>> _workers;  // Очереди рабочих потоков
+    std::vector<std::thread>             _threads;  // Рабочие потоки
+    const int                            _spin;     // Число попыток найти задачу перед засыпанием
+    std::atomic<int>                     _pending;  // Количество задач во всех очередях
+    std::atomic<unsigned>                _next;     // Очередь для следующей внешней задачи
+    std::atomic<int>                     _concurrency; // Наибольшее число кусков цикла, 0 - все потоки
+    std::atomic<bool>                    _stop;
+    std::mutex                           _park_mutex;
+    std::condition_variable              _park_cv;
+
+    // Индекс рабочего потока текущего пула, -1 для внешних потоков
+    static int& worker_index()
+    {
+        static thread_local int index = -1;
+        return index;
+    }
+
+    static const ThreadPool*& current_pool()
+    {
+        static thread_local const ThreadPool* pool = NULL;
+        return pool;
+    }
+
+    int self() const
+    {
+        return (current_pool() == this) ? worker_index() : -1;
+    }
+
+    void push(Task task)
+    {
+        const int me = self();
+        const int nworker = _workers.size();
+        const int id = (me >= 0) ? me : int(_next.fetch_add(1, std::memory_order_relaxed) % nworker);
+        {
+            std::lock_guard<std::mutex> lock(_workers[id]->mutex);
+            _workers[id]->tasks.push_back(std::move(task));
+        }
+        _pending.fetch_add(1, std::memory_order_release);
+        {
+            // Захват мьютекса исключает потерю пробуждения между проверкой и ожиданием
+            std::lock_guard<std::mutex> lock(_park_mutex);
+        }
+        _park_cv.notify_one();
+    }
+
+    // Взять задачу: сначала из своей очереди (LIFO), затем украсть у других (FIFO)
+    bool pop(int me, Task& task)
+    {
+        if (_pending.load(std::memory_order_acquire) <= 0) return false;
+
+        const int nworker = _workers.size();
+
+        if (me >= 0)
+        {
+            Worker& own = *_workers[me];
+            std::lock_guard<std::mutex> lock(own.mutex);
+
+            if (!own.tasks.empty())
+            {
+                own.tasks.pop_back(task);
+                _pending.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+
+        const int start = (me >= 0) ? me + 1 : 0;
+
+        for (int i = 0; i < nworker; i++)
+        {
+            const int victim = (start + i) % nworker;
+            if (victim == me) continue;
+
+            Worker& other = *_workers[victim];
+            std::lock_guard<std::mutex> lock(other.mutex);
+
+            if (!other.tasks.empty())
+            {
+                other.tasks.pop_front(task);
+                _pending.fetch_sub(1, std::memory_order_relaxed);
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void run(int me, int cpu)
+    {
+        worker_index() = me;
+        current_pool() = this;
+#ifdef __linux__
+        if (cpu >= 0)
+        {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        }
+#endif
+        Task task;
+
+        while (true)
+        {
+            if (pop(me, task))
+            {
+                task();
+                task = nullptr;
+                continue;
+            }
+
+            // Активное ожидание перед засыпанием
+            bool found = false;
+
+            for (int i = 0; i < _spin && !found; i++)
+            {
+                if (_stop.load(std::memory_order_acquire)) break;
+                std::this_thread::yield();
+                found = _pending.load(std::memory_order_acquire) > 0;
+            }
+
+            if (found) continue;
+
+            std::unique_lock<std::mutex> lock(_park_mutex);
+            _park_cv.wait(lock, [this]
+            {
+                return _stop.load(std::memory_order_acquire) ||
+                       _pending.load(std::memory_order_acquire) > 0;
+            });
+
+            if (_stop.load(std::memory_order_acquire) &&
+                    _pending.load(std::memory_order_acquire) <= 0) return;
+        }
+    }
+
+public:
+    /// \param nthread Количество рабочих потоков. Если `nthread <= 0`, используется
+    ///                число аппаратных потоков минус один (вызывающий поток тоже работает).
+    /// \param spin    Количество попыток найти задачу перед засыпанием потока.
+    ///                `0` означает немедленное засыпание.
+    /// \param cpus    Номера ядер для привязки рабочих потоков. Пустой вектор
+    ///                оставляет распределение операционной системе.
+    ThreadPool(int nthread = 0, int spin = 0, const std::vector<int>& cpus = std::vector<int>()) :
+        _spin(spin), _pending(0), _next(0), _concurrency(0), _stop(false)
+    {
+        if (nthread <= 0)
+        {
+            const int hw = std::thread::hardware_concurrency();
+            nthread = (hw > 1) ? hw - 1 : 1;
+        }
+
+        internal::acquire_eigen_threads();
+
+        _workers.reserve(nthread);
+        for (int i = 0; i < nthread; i++) _workers.emplace_back(new Worker());
+
+        _threads.reserve(nthread);
+        for (int i = 0; i < nthread; i++)
+        {
+            const int cpu = cpus.empty() ? -1 : cpus[i % cpus.size()];
+            _threads.emplace_back(&ThreadPool::run, this, i, cpu);
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /// Деструктор дожидается выполнения всех поставленных задач
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(_park_mutex);
+            _stop.store(true, std::memory_order_release);
+        }
+        _park_cv.notify_all();
+
+        for (std::size_t i = 0; i < _threads.size(); i++) _threads[i].join();
+
+        internal::release_eigen_threads();
+    }
+
+    /// Количество рабочих потоков пула
+    int num_threads() const { return _threads.size(); }
+
+    /// Ограничить число потоков (включая вызывающий), между которыми делится
+    /// параллельный цикл. Один пул может так обслуживать этапы, которым нужно
+    /// разное количество потоков. `0` снимает ограничение.
+    void set_concurrency(int nthread) { _concurrency.store(std::max(0, nthread), std::memory_order_relaxed);}
+
+    /// Поставить задачу в пул
+    /// \return Объект `std::future` для ожидания результата.
+    template <typename Function>
+    std::future<void> submit(Function func)
+    {
+        std::shared_ptr< std::packaged_task<void()> > task =
+            std::make_shared< std::packaged_task<void()> >(std::move(func));
+        std::future<void> res = task->get_future();
+        push([task]() { (*task)(); });
+        return res;
+    }
+
+    /// Поставить задачу в пул без объекта ожидания. Задача, которая захватывает
+    /// один указатель, не выделяет память в куче; о своем завершении она
+    /// сообщает сама, например флагом для wait(const std::atomic<bool>&).
+    template <typename Function>
+    void post(Function func)
+    {
+        push(Task(std::move(func)));
+    }
+
+    /// Выполнить одну задачу из очередей пула в текущем потоке
+    /// \return `true`, если задача была найдена и выполнена.
+    bool run_pending()
+    {
+        Task task;
+        if (!pop(self(), task)) return false;
+        task();
+        return true;
+    }
+
+    /// Ожидать `future`, выполняя задачи пула вместо простоя
+    void wait(std::future<void>& res)
+    {
+        while (res.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+        {
+            if (!run_pending()) std::this_thread::yield();
+        }
+        res.get();
+    }
+
+    /// Ожидать установки флага `done`, выполняя задачи пула вместо простоя
+    void wait(const std::atomic<bool>& done)
+    {
+        while (!done.load(std::memory_order_acquire))
+        {
+            if (!run_pending()) std::this_thread::yield();
+        }
+    }
+
+    /// Параллельный цикл по диапазону `[begin, end)`
+    ///
+    /// Диапазон разбивается на непрерывные куски размером не меньше `grain`,
+    /// `func(b, e)` вызывается для каждого куска. Вызывающий поток обрабатывает
+    /// первый кусок сам и помогает с остальными, поэтому вложенные вызовы
+    /// из рабочих потоков не приводят к взаимоблокировке.
+    template <typename Function>
+    void parallel_for(int begin, int end, int grain, const Function& func)
+    {
+        const int n = end - begin;
+        if (n <= 0) return;
+        if (grain < 1) grain = 1;
+
+        int nthread = num_threads() + 1;
+        const int limit = _concurrency.load(std::memory_order_relaxed);
+
+        if (limit > 0 && limit < nthread) nthread = limit;
+
+        int nchunk = std::min(nthread, (n + grain - 1) / grain);
+
+        if (nchunk <= 1)
+        {
+            func(begin, end);
+            return;
+        }
+
+        const int chunk = (n + nchunk - 1) / nchunk;
+        nchunk = (n + chunk - 1) / chunk;
+        ForJob<Function> job(func, begin, end, chunk, nchunk);
+        ForJob<Function>* pjob = &job;
+
+        for (int i = 1; i < nchunk; i++) push([pjob, i]() { pjob->run(i); });
+
+        job.run(0);
+
+        while (job.remaining.load(std::memory_order_acquire) > 0)
+        {
+            if (!run_pending()) std::this_thread::yield();
+        }
+
+        if (job.error) std::rethrow_exception(job.error);
+    }
+};
+
+
+namespace internal
+{
+// Параллельный цикл, который выполняется последовательно, если пул не задан
+template <typename Function>
+inline void parallel_for(ThreadPool* pool, int begin, int end, int grain, const Function& func)
+{
+    if (pool == NULL)
+    {
+        if (end > begin) func(begin, end);
+        return;
+    }
+
+    pool->parallel_for(begin, end, grain, func);
+}
+
+}
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <stdexcept>
+
+namespace NNE
+{
+
+/// Измеренные оптимальные настройки производительности для пары
+/// (модель процессора, форма сети)
+struct TuningProfile
+{
+    int batch_size;      // Размер мини-пакета для обучения
+    int nthread;         // Количество потоков для обучения (включая вызывающий)
+    int kernel;          // Ядро умножения матриц для обучения, см. internal::KERNEL_ENUM
+    int predict_nthread; // Количество потоков для прогноза
+    int predict_kernel;  // Ядро умножения матриц для прогноза
+
+    TuningProfile() : batch_size(0), nthread(1), kernel(0), predict_nthread(1), predict_kernel(0) {}
+};
+
+namespace internal
+{
+// Заменить пробельные символы, чтобы ключ был одним словом в файле профилей
+inline std::string sanitize_key(const std::string& str)
+{
+    std::string res = str;
+
+    for (std::size_t i = 0; i < res.size(); i++)
+        if (res[i] == ' ' || res[i] == '\t' || res[i] == '\n') res[i] = '_';
+
+    return res;
+}
+
+}
+
+/// Модель процессора и число аппаратных потоков, например
+/// `Intel(R)_Core(TM)_i5-8250U_CPU_@_1.60GHz/8` или `ARM_0xd03/4`
+inline std::string cpu_model()
+{
+    std::string model;
+    std::ifstream cpuinfo("/proc/cpuinfo");
+    std::string line;
+
+    while (model.empty() && std::getline(cpuinfo, line))
+    {
+        const std::size_t pos = line.find(':');
+        if (pos == std::string::npos) continue;
+
+        std::string name = line.substr(0, pos);
+        name.erase(name.find_last_not_of(" \t") + 1);
+        std::string value = line.substr(pos + 1);
+        value.erase(0, value.find_first_not_of(" \t"));
+
+        // x86: "model name"; ARM: "CPU part" (ядро) или "Hardware"/"Model" (плата)
+        if (name == "model name") model = value;
+        else if (name == "CPU part") model = "ARM " + value;
+        else if (name == "Hardware" || name == "Model") model = value;
+    }
+
+    if (model.empty()) model = "unknown";
+
+    std::ostringstream res;
+    res << model << '/' << std::thread::hardware_concurrency();
+    return internal::sanitize_key(res.str());
+}
+
+/// Найти профиль по ключу в файле профилей
+/// \return `true`, если профиль найден.
+inline bool load_tuning_profile(const std::string& filename, const std::string& key, TuningProfile& profile)
+{
+    std::ifstream file(filename.c_str());
+    std::string line;
+    const std::string skey = internal::sanitize_key(key);
+
+    while (std::getline(file, line))
+    {
+        std::istringstream ss(line);
+        std::string k;
+        TuningProfile p;
+
+        if (!(ss >> k >> p.batch_size >> p.nthread >> p.kernel >> p.predict_nthread >> p.predict_kernel))
+            continue;
+
+        if (k == skey)
+        {
+            profile = p;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/// Сохранить профиль в файл профилей, заменив профиль с тем же ключом.
+/// Формат файла: по одной строке `ключ batch_size nthread kernel predict_nthread predict_kernel`.
+inline void save_tuning_profile(const std::string& filename, const std::string& key, const TuningProfile& profile)
+{
+    const std::string skey = internal::sanitize_key(key);
+    std::vector<std::string> lines;
+    {
+        std::ifstream file(filename.c_str());
+        std::string line;
+
+        while (std::getline(file, line))
+        {
+            std::istringstream ss(line);
+            std::string k;
+
+            if ((ss >> k) && k != skey) lines.push_back(line);
+        }
+    }
+
+    std::ofstream file(filename.c_str());
+
+    if (!file) throw std::runtime_error("[function save_tuning_profile]: Cannot write file " + filename);
+
+    for (std::size_t i = 0; i < lines.size(); i++) file << lines[i] << '\n';
+
+    file << skey << ' ' << profile.batch_size << ' ' << profile.nthread << ' ' << profile.kernel << ' '
+         << profile.predict_nthread << ' ' << profile.predict_kernel << '\n';
+}
+
+}
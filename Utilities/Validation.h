@@ -0,0 +1,190 @@
+#pragma once
+
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+#include "/home/dimka/Eigen/Core"
+#include "InitScalar.h"
+#include "Arena.h"
+#include "Checkpoint.h"
+#include "Layer/Layer.h"
+#include "Output/Output.h"
+
+namespace NNE
+{
+
+/// Отдельный контекст вывода для оценки модели в другом потоке.
+///
+/// Содержит копии слоев и выходного слоя со своими параметрами и своей ареной,
+/// поэтому не разделяет никаких буферов со слоями, которые продолжают обучаться.
+///
+class InferenceContext
+{
+private:
+    typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+
+    std::vector<Layer*> _layers;
+    Output*             _output;
+    Arena               _arena;
+    int                 _max_batch;
+
+    void reserve(int max_batch)
+    {
+        const int nlayer = _layers.size();
+        const int nvar = _layers[nlayer - 1]->out_size();
+        std::size_t bytes = _output->buffer_size(nvar, max_batch);
+
+        for (int i = 0; i < nlayer; i++) bytes += _layers[i]->buffer_size(max_batch);
+
+        _arena.reserve(bytes);
+
+        for (int i = 0; i < nlayer; i++) _layers[i]->bind_buffers(_arena, max_batch);
+
+        _output->bind_buffers(_arena, nvar, max_batch);
+        _max_batch = max_batch;
+    }
+
+public:
+    InferenceContext(const std::vector<const Layer*>& layers, const Output* output) :
+        _output(NULL), _max_batch(0)
+    {
+        if (layers.empty() || output == NULL)
+            throw std::invalid_argument("[class InferenceContext]: Network has no layers or no output layer");
+
+        _layers.reserve(layers.size());
+
+        for (std::size_t i = 0; i < layers.size(); i++) _layers.push_back(layers[i]->clone());
+
+        _output = output->clone();
+    }
+
+    InferenceContext(const InferenceContext&) = delete;
+    InferenceContext& operator=(const InferenceContext&) = delete;
+
+    ~InferenceContext()
+    {
+        for (std::size_t i = 0; i < _layers.size(); i++) delete _layers[i];
+        delete _output;
+    }
+
+    /// Загрузить параметры всех слоев, записанные Network::copy_parameters()
+    void load_parameters(const Scalar* src)
+    {
+        for (std::size_t i = 0; i < _layers.size(); i++)
+        {
+            _layers[i]->load_parameters(src);
+            src += _layers[i]->num_parameters();
+        }
+    }
+
+    /// Значение функции потерь на наборе (x, y)
+    /// \param chunk Набор оценивается частями по `chunk` наблюдений, поэтому буферы
+    ///              контекста рассчитаны на часть, а не на весь набор. `0` - целиком.
+    Scalar evaluate(const Matrix& x, const Matrix& y, int chunk = 0)
+    {
+        const int nobs = x.cols();
+
+        if (chunk <= 0 || chunk > nobs) chunk = nobs;
+
+        if (chunk > _max_batch) reserve(chunk);
+
+        double loss = 0;
+
+        for (int b = 0; b < nobs; b += chunk)
+        {
+            const int n = std::min(chunk, nobs - b);
+            _layers[0]->forward(x.middleCols(b, n));
+
+            for (std::size_t i = 1; i < _layers.size(); i++) _layers[i]->forward(_layers[i - 1]->output());
+
+            // Явный Ref исключает неоднозначность с перегрузкой для меток классов
+            _output->evaluate(_layers.back()->output(), Eigen::Ref<const Matrix>(y.middleCols(b, n)));
+            // Потери части усреднены по ее наблюдениям, взвешиваем их размером части
+            loss += double(_output->loss()) * n;
+        }
+
+        return Scalar(loss / nobs);
+    }
+};
+
+
+/// Политика ранней остановки по потерям на проверочном наборе.
+///
+/// Обучение останавливается, если потери не улучшались больше чем на `min_delta`
+/// в течение `patience` проверок. Параметры с наилучшими потерями сохраняются
+/// и восстанавливаются в сети после остановки.
+///
+class EarlyStopping
+{
+private:
+    const int           _patience;   // Допустимое число проверок без улучшения
+    const Scalar        _min_delta;  // Минимальное улучшение потерь
+    Scalar              _best_loss;  // Наилучшие потери
+    int                 _best_epoch; // Эпоха наилучших потерь
+    int                 _wait;       // Проверок подряд без улучшения
+    std::vector<Scalar> _best_param; // Параметры с наилучшими потерями
+
+public:
+    EarlyStopping(int patience = 5, const Scalar& min_delta = Scalar(0)) :
+        _patience(patience), _min_delta(min_delta)
+    {
+        reset();
+    }
+
+    /// Сбросить историю перед новым обучением
+    void reset()
+    {
+        _best_loss = std::numeric_limits<Scalar>::infinity();
+        _best_epoch = -1;
+        _wait = 0;
+        _best_param.clear();
+    }
+
+    /// Учесть результат проверки
+    /// \param epoch Эпоха, после которой сделан снимок параметров.
+    /// \param loss  Потери на проверочном наборе.
+    /// \param param Снимок параметров, Network::copy_parameters().
+    /// \param n     Количество параметров.
+    /// \return `true`, если обучение следует остановить.
+    bool update(int epoch, const Scalar& loss, const Scalar* param, std::size_t n)
+    {
+        if (loss < _best_loss - _min_delta)
+        {
+            _best_loss = loss;
+            _best_epoch = epoch;
+            _wait = 0;
+            _best_param.assign(param, param + n);
+            return false;
+        }
+
+        return ++_wait >= _patience;
+    }
+
+    Scalar best_loss() const { return _best_loss;}
+
+    int best_epoch() const { return _best_epoch;}
+
+    /// Параметры с наилучшими потерями, пусто если проверок не было
+    const std::vector<Scalar>& best_parameters() const { return _best_param;}
+
+    /// Скопировать состояние для контрольной точки. После первого вызова память не выделяется.
+    void get_state(StoppingState& state) const
+    {
+        state.best_loss = _best_loss;
+        state.best_epoch = _best_epoch;
+        state.wait = _wait;
+        state.best_param.assign(_best_param.begin(), _best_param.end());
+    }
+
+    /// Восстановить состояние, сохраненное get_state()
+    void set_state(const StoppingState& state)
+    {
+        _best_loss = state.best_loss;
+        _best_epoch = state.best_epoch;
+        _wait = state.wait;
+        _best_param = state.best_param;
+    }
+};
+
+}
@@ -0,0 +1,102 @@
+// Сравнение NetworkEnsemble с K отдельными вызовами Network::fit.
+// Проверяет, что predict(k, x) и export_model(k) совпадают с сетью,
+// обученной fit() с тем же оптимизатором SGD и начальным числом, что
+// set_optimizers() отклоняет другие оптимизаторы, и выводит время обоих способов.
+//
+// g++ -std=c++17 -O2 -I. bench_ensemble.cpp -o bench_ensemble -pthread
+
+#include <iostream>
+#include <chrono>
+#include <vector>
+#include "NetworkEnsemble.h"
+#include "Activation/ReLU.h"
+#include "Optimizer/SGD.h"
+
+using namespace NNE;
+typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+
+// Оптимизатор, отличный от SGD, который ансамбль должен отклонить
+class OtherOptimizer : public Optimizer
+{
+public:
+    void reset() override {}
+
+    void update(ConstAlignedMapVec& dvec, AlignedMapVec& vec) override { vec -= dvec;}
+};
+
+int main()
+{
+    const int nmodel = 64, batch_size = 32, epoch = 5, seed = 7;
+    const std::vector<int> units = {8, 16, 2};
+    const Matrix x = Matrix::Random(units[0], 4000);
+    const Matrix y = x.topRows(2).array().square().matrix();
+    std::vector<int> seeds;
+    std::vector<SGD> opts;
+    std::vector<const Optimizer*> opt_ptrs;
+
+    for (int k = 0; k < nmodel; k++)
+    {
+        seeds.push_back(k + 1);
+        opts.push_back(SGD(Scalar(0.01) * (k + 1), Scalar(0.001) * (k % 3)));
+    }
+
+    for (int k = 0; k < nmodel; k++) opt_ptrs.push_back(&opts[k]);
+
+    // K отдельных сетей
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<Matrix> preds;
+
+    for (int k = 0; k < nmodel; k++)
+    {
+        Network net;
+        net.add_layer(new Dense<ReLU>(units[0], units[1]));
+        net.add_layer(new Dense<ReLU>(units[1], units[2]));
+        net.set_output(new RegressionMSE());
+        net.init(0, 0.1, seeds[k]);
+        net.fit(opts[k], x, y, batch_size, epoch, seed);
+        preds.push_back(net.predict(x));
+    }
+
+    const double time_separate = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // Один ансамбль
+    start = std::chrono::steady_clock::now();
+    NetworkEnsemble<ReLU> ens(nmodel, units);
+    ens.init(seeds, 0, 0.1);
+    ens.set_optimizers(opt_ptrs);
+    ens.fit(x, y, batch_size, epoch, seed);
+    const double time_ensemble = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    double diff_predict = 0, diff_export = 0;
+
+    for (int k = 0; k < nmodel; k++)
+    {
+        diff_predict = std::max<double>(diff_predict, (ens.predict(k, x) - preds[k]).cwiseAbs().maxCoeff());
+        Network net;
+        ens.export_model(k, net);
+        diff_export = std::max<double>(diff_export, (net.predict(x) - preds[k]).cwiseAbs().maxCoeff());
+    }
+
+    std::cout << nmodel << " models, " << x.cols() << " observations, " << epoch << " epochs" << std::endl;
+    std::cout << "separate fit: " << time_separate << " s (" << nmodel * epoch * x.cols() / time_separate << " obs/s)" << std::endl;
+    std::cout << "ensemble fit: " << time_ensemble << " s (" << nmodel * epoch * x.cols() / time_ensemble << " obs/s)" << std::endl;
+    std::cout << "max diff predict(k): " << diff_predict << ", export_model(k): " << diff_export << std::endl;
+
+    OtherOptimizer other;
+    opt_ptrs[1] = &other;
+    bool rejected = false;
+
+    try
+    {
+        ens.set_optimizers(opt_ptrs);
+    }
+    catch (const std::invalid_argument& e)
+    {
+        rejected = true;
+        std::cout << "other optimizer: " << e.what() << std::endl;
+    }
+
+    const bool ok = diff_predict < 1e-4 && diff_export < 1e-4 && rejected;
+    std::cout << (ok ? "OK" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
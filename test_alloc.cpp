@@ -0,0 +1,144 @@
+// Проверка отсутствия выделений памяти в установившемся режиме:
+// fit() с неполным последним пакетом, последовательно и с пулом потоков, вместе с
+// накоплением градиентов, синхронизацией градиентов через коммуникатор, проверкой
+// с ранней остановкой, контрольными точками и записью телеметрии через обратный
+// вызов по умолчанию; partial_fit() с резервуаром повторного использования;
+// predict(x, res) с готовым результатом. Учитываются и выделения фоновых потоков
+// (проверка, запись контрольных точек, телеметрия).
+//
+// g++ -std=c++17 -O2 -I. test_alloc.cpp -o test_alloc -pthread
+
+#define NNE_COUNT_ALLOCATIONS
+#include "Utilities/AllocCounter.h"
+#include <iostream>
+#include <cstdio>
+#include "Network.h"
+#include "Layer/Dense.h"
+#include "Activation/ReLU.h"
+#include "Optimizer/SGD.h"
+#include "Output/Regression.h"
+
+using namespace NNE;
+typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+
+// Приемник телеметрии, который только считает сводки и сам не выделяет память
+class CountSink : public TelemetrySink
+{
+public:
+    std::atomic<int> nsummary{0};
+
+    void write(const TelemetrySummary& s) override { nsummary++;}
+};
+
+// Считает пакеты fit(), во время которых была выделена память. Первые эпохи -
+// прогрев: в них размещаются буферы слоев, контекста проверки и ранней остановки.
+// Запись телеметрии передается обратным вызовом по умолчанию.
+class AllocCallback : public Callback
+{
+public:
+    int  warmup;
+    long last = 0, nbatch = 0, nbatch_alloc = 0;
+
+    AllocCallback(Telemetry* telemetry, int warmup_epochs) : Callback(telemetry), warmup(warmup_epochs) {}
+
+    void post_training_batch(const Network* net, const Matrix& x, const Matrix& y) override
+    {
+        Callback::post_training_batch(net, x, y);
+        const long count = allocation_count();
+
+        if (_nbatch > 1 && _epoch_id >= warmup)
+        {
+            nbatch++;
+
+            if (count != last) nbatch_alloc++;
+        }
+
+        last = count;
+    }
+};
+
+bool run(int nthread)
+{
+    // 1030 наблюдений по 100: последний пакет неполный, пакеты делятся на части по 30
+    const Matrix x = Matrix::Random(8, 1030);
+    const Matrix y = x.topRows(2).array().square().matrix();
+    const Matrix x_val = Matrix::Random(8, 300);
+    const Matrix y_val = x_val.topRows(2).array().square().matrix();
+    // Окна потока для partial_fit()
+    const int nwindow = 32, window = 30;
+    std::vector<Matrix> x_win(nwindow), y_win(nwindow);
+
+    for (int i = 0; i < nwindow; i++)
+    {
+        x_win[i] = Matrix::Random(8, window);
+        y_win[i] = x_win[i].topRows(2).array().square().matrix();
+    }
+
+    const std::string ckpt_file = "test_alloc.ckpt";
+    ThreadPool* pool = (nthread > 0) ? new ThreadPool(nthread) : NULL;
+    bool ok;
+    {
+        // Один процесс: коммуникатор не открывает соединений, но градиенты проходят
+        // через буфер синхронизации и фоновый поток; корзины меньше сети
+        TcpCommunicator comm(0, 1, 29500);
+        Network net;
+        net.add_layer(new Dense<ReLU>(8, 64));
+        net.add_layer(new Dense<ReLU>(64, 2));
+        net.set_output(new RegressionMSE());
+        net.set_thread_pool(pool);
+        net.init(0, 0.1, 42);
+        net.set_micro_batch(30);
+        net.set_communicator(&comm, 256);
+        // Терпение больше числа эпох: обучение не останавливается раньше времени
+        EarlyStopping stopping(100);
+        net.set_validation(x_val, y_val, &stopping);
+        Checkpointer checkpointer(ckpt_file, 3);
+        net.set_checkpointer(&checkpointer);
+        SGD opt(0.05);
+        // Короткий период: фоновый поток телеметрии сводит записи во время обучения
+        CountSink sink;
+        Telemetry telemetry(sink, 0.001);
+        AllocCallback callback(&telemetry, 3);
+        net.set_callback(callback);
+        net.fit(opt, x, y, 100, 7, 1);
+        checkpointer.wait();
+
+        // Онлайн-обучение: первые окна размещают буферы резервуара и смешанного пакета
+        ReplayReservoir replay(200, 8, 2);
+
+        for (int i = 0; i < 3; i++) net.partial_fit(opt, x_win[i], y_win[i], &replay, 20);
+
+        long before = allocation_count();
+
+        for (int i = 3; i < nwindow; i++) net.partial_fit(opt, x_win[i], y_win[i], &replay, 20);
+
+        const long partial_fit_alloc = allocation_count() - before;
+        checkpointer.wait();
+        net.set_checkpointer(NULL);
+
+        Matrix res;
+        net.predict(x, res);
+        before = allocation_count();
+
+        for (int i = 0; i < 10; i++) net.predict(x, res);
+
+        const long predict_alloc = allocation_count() - before;
+        std::cout << "worker threads " << nthread << ": fit batches with allocations " << callback.nbatch_alloc
+                  << " of " << callback.nbatch << ", partial_fit allocations " << partial_fit_alloc
+                  << ", predict allocations " << predict_alloc << ", checkpoints " << checkpointer.num_written()
+                  << std::endl;
+        ok = callback.nbatch > 0 && callback.nbatch_alloc == 0 && partial_fit_alloc == 0 &&
+             predict_alloc == 0 && checkpointer.num_written() > 0 && checkpointer.error().empty();
+        net.set_default_callback();
+    }
+    delete pool;
+    std::remove(ckpt_file.c_str());
+    return ok;
+}
+
+int main()
+{
+    const bool ok = run(0) && run(3);
+    std::cout << (ok ? "OK" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
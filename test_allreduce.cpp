@@ -0,0 +1,419 @@
+// Проверка обучения в нескольких процессах на одной машине: процессы
+// создаются fork(), каждый обучает копию сети на своей части пакета.
+// Для обоих способов связи (общая память и TCP через 127.0.0.1) параметры
+// должны совпасть во всех процессах до бита и с обучением одного процесса
+// на полном пакете, в том числе после fit() с ранней остановкой по
+// разным проверочным наборам. Также проверяются отказы: сегмент от прерванного
+// запуска, завершившийся участник, отсутствующий сосед, чужое соединение
+// и сосед, который перестал участвовать в обмене.
+//
+// g++ -std=c++17 -O2 -I. test_allreduce.cpp -o test_allreduce -pthread -lrt
+
+#include <iostream>
+#include <sys/wait.h>
+#include "Network.h"
+#include "Layer/Dense.h"
+#include "Activation/ReLU.h"
+#include "Optimizer/SGD.h"
+#include "Output/Regression.h"
+
+using namespace NNE;
+typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+
+const int nrank = 3, batch_size = 40, nstep = 50;
+
+enum { SHM, TCP };
+
+Communicator* create_communicator(int mode, const std::string& name, int port, int rank, int size)
+{
+    if (mode == SHM) return new ShmCommunicator(name, rank, size, 100, 10);
+
+    return new TcpCommunicator(rank, size, port, "127.0.0.1", "127.0.0.1", 10);
+}
+
+void build(Network& net, int seed)
+{
+    net.add_layer(new Dense<ReLU>(8, 32));
+    net.add_layer(new Dense<ReLU>(32, 16));
+    net.add_layer(new Dense<ReLU>(16, 2));
+    net.set_output(new RegressionMSE());
+    net.init(0, 0.3, seed);
+}
+
+// Процесс `rank`: обучение на своей части данных, параметры передаются родителю через `fd`
+void run_rank(int mode, const std::string& name, int port, int rank, const Matrix& x, const Matrix& y, int fd)
+{
+    Communicator* comm = create_communicator(mode, name, port, rank, nrank);
+    {
+        Network net;
+        // Разные начальные параметры выравниваются рассылкой от процесса 0
+        build(net, rank == 0 ? 5 : 77 + rank);
+        ThreadPool pool(1);
+
+        if (rank == 1) net.set_thread_pool(&pool);
+        if (rank == 2) net.set_micro_batch(7);
+
+        // Маленькие корзины: каждый слой усредняется отдельно, параллельно с обратным проходом
+        net.set_communicator(comm, 256);
+        net.broadcast_parameters();
+        SGD opt(0.05);
+        const Matrix xs = x.middleCols(rank * batch_size, batch_size);
+        const Matrix ys = y.middleCols(rank * batch_size, batch_size);
+
+        for (int i = 0; i < nstep; i++) net.train_step(opt, xs, ys);
+
+        std::vector<Scalar> param(net.num_parameters());
+        net.copy_parameters(param.data());
+        const ssize_t bytes = param.size() * sizeof(Scalar);
+
+        if (write(fd, param.data(), bytes) != bytes) _exit(2);
+
+        net.set_communicator(NULL);
+    }
+    delete comm;
+}
+
+bool test_training(int mode, const std::string& name, int port)
+{
+    const Matrix x = Matrix::Random(8, nrank * batch_size);
+    const Matrix y = x.topRows(2).array().square().matrix();
+
+    // Один процесс на полном пакете
+    Network ref;
+    build(ref, 5);
+    SGD opt(0.05);
+
+    for (int i = 0; i < nstep; i++) ref.train_step(opt, x, y);
+
+    std::vector<Scalar> ref_param(ref.num_parameters());
+    ref.copy_parameters(ref_param.data());
+
+    int fds[nrank][2];
+
+    for (int r = 0; r < nrank; r++)
+    {
+        if (pipe(fds[r]) != 0) return false;
+
+        if (fork() == 0)
+        {
+            close(fds[r][0]);
+
+            try
+            {
+                run_rank(mode, name, port, r, x, y, fds[r][1]);
+            }
+            catch (const std::exception& e)
+            {
+                std::cerr << "rank " << r << ": " << e.what() << std::endl;
+                _exit(1);
+            }
+
+            _exit(0);
+        }
+
+        close(fds[r][1]);
+    }
+
+    std::vector< std::vector<Scalar> > param(nrank, std::vector<Scalar>(ref_param.size()));
+    bool ok = true;
+
+    for (int r = 0; r < nrank; r++)
+    {
+        const ssize_t bytes = ref_param.size() * sizeof(Scalar);
+        ok = ok && read(fds[r][0], param[r].data(), bytes) == bytes;
+        close(fds[r][0]);
+    }
+
+    for (int r = 0; r < nrank; r++)
+    {
+        int status;
+        wait(&status);
+        ok = ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+
+    if (!ok) return false;
+
+    double diff = 0;
+
+    for (std::size_t i = 0; i < ref_param.size(); i++)
+        diff = std::max<double>(diff, std::abs(param[0][i] - ref_param[i]));
+
+    bool identical = true;
+
+    for (int r = 1; r < nrank; r++) identical = identical && param[r] == param[0];
+
+    std::cout << (mode == SHM ? "shm" : "tcp") << ": ranks identical " << identical
+              << ", max diff vs single process " << diff << std::endl;
+    return identical && diff < 1e-6;
+}
+
+// fit() с ранней остановкой, у каждого процесса свой проверочный набор: у процесса 1
+// цели зашумлены, и по своим потерям он остановился бы раньше остальных.
+// Потери усредняются между процессами, поэтому решения об остановке совпадают
+// и процессы заканчивают с одинаковыми параметрами.
+bool test_validation(const std::string& name, int port)
+{
+    const Matrix x = Matrix::Random(8, nrank * batch_size * 5);
+    const Matrix y = x.topRows(2).array().square().matrix();
+    const int nepoch = 30;
+    int fds[nrank][2];
+
+    for (int r = 0; r < nrank; r++)
+    {
+        if (pipe(fds[r]) != 0) return false;
+
+        if (fork() == 0)
+        {
+            close(fds[r][0]);
+
+            try
+            {
+                Communicator* comm = create_communicator(SHM, name, port, r, nrank);
+                {
+                    Network net;
+                    build(net, 5);
+                    net.set_communicator(comm, 256);
+                    const int nobs = x.cols() / nrank;
+                    const Matrix xs = x.middleCols(r * nobs, nobs);
+                    const Matrix ys = y.middleCols(r * nobs, nobs);
+                    const Matrix x_val = Matrix::Random(8, 50);
+                    const Matrix y_val = (r == 1) ? Matrix(Matrix::Random(2, 50).array() * Scalar(0.5) + x_val.topRows(2).array().square()) :
+                                         Matrix(x_val.topRows(2).array().square().matrix());
+                    EarlyStopping stopping(2, Scalar(1e-4));
+                    net.set_validation(x_val, y_val, &stopping);
+                    SGD opt(0.05);
+                    net.fit(opt, xs, ys, batch_size, nepoch, 3);
+
+                    std::vector<Scalar> param(net.num_parameters() + 1);
+                    param[0] = stopping.best_epoch();
+                    net.copy_parameters(param.data() + 1);
+                    const ssize_t bytes = param.size() * sizeof(Scalar);
+
+                    if (write(fds[r][1], param.data(), bytes) != bytes) _exit(2);
+
+                    net.set_communicator(NULL);
+                }
+                delete comm;
+            }
+            catch (const std::exception& e)
+            {
+                std::cerr << "rank " << r << ": " << e.what() << std::endl;
+                _exit(1);
+            }
+
+            _exit(0);
+        }
+
+        close(fds[r][1]);
+    }
+
+    Network net;
+    build(net, 5);
+    std::vector< std::vector<Scalar> > param(nrank, std::vector<Scalar>(net.num_parameters() + 1));
+    bool ok = true;
+
+    for (int r = 0; r < nrank; r++)
+    {
+        const ssize_t bytes = param[r].size() * sizeof(Scalar);
+        ok = ok && read(fds[r][0], param[r].data(), bytes) == bytes;
+        close(fds[r][0]);
+    }
+
+    for (int r = 0; r < nrank; r++)
+    {
+        int status;
+        wait(&status);
+        ok = ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    }
+
+    for (int r = 1; r < nrank; r++) ok = ok && param[r] == param[0];
+
+    std::cout << "validation: best epoch " << param[0][0] << ", ranks identical " << ok << std::endl;
+    return ok;
+}
+
+// Сегмент с испорченным заголовком, оставшийся от прерванного запуска
+bool test_stale_segment(const std::string& name, int port)
+{
+    const int fd = shm_open(name.c_str(), O_CREAT | O_RDWR, 0600);
+
+    if (fd < 0 || ftruncate(fd, 1 << 16) != 0) return false;
+
+    void* mem = mmap(NULL, 1 << 16, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    std::memset(mem, 0x7f, 1 << 16);
+    munmap(mem, 1 << 16);
+    close(fd);
+    return test_training(SHM, name, port);
+}
+
+// Участник завершился, не дойдя до allreduce: остальные получают исключение, а не зависают
+bool test_dead_peer(const std::string& name)
+{
+    if (fork() == 0)
+    {
+        new ShmCommunicator(name, 1, 2, 100, 10);
+        _exit(0);
+    }
+
+    bool ok = false;
+
+    try
+    {
+        ShmCommunicator comm(name, 0, 2, 100, 10);
+        std::vector<Scalar> data(10, Scalar(1));
+        comm.allreduce(data.data(), data.size());
+    }
+    catch (const std::runtime_error& e)
+    {
+        std::cout << "dead peer: " << e.what() << std::endl;
+        ok = true;
+    }
+
+    wait(NULL);
+    shm_unlink(name.c_str());
+    return ok;
+}
+
+// Процесс 2 не запущен: процесс 0 из трех подключается к процессу 1 (здесь его
+// заменяет простой слушающий сокет), но не дожидается соседа слева и завершается по таймауту
+bool test_missing_peer(int port)
+{
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port + 1);
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    const int listener = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (bind(listener, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, 1) != 0) return false;
+
+    bool ok = false;
+
+    try
+    {
+        TcpCommunicator comm(0, 3, port, "127.0.0.1", "127.0.0.1", 1);
+    }
+    catch (const std::runtime_error& e)
+    {
+        std::cout << "missing peer: " << e.what() << std::endl;
+        ok = true;
+    }
+
+    close(listener);
+    return ok;
+}
+
+// Сосед установил кольцо, но не вызывает allreduce: шаг обучения завершается
+// исключением из GradientSync::wait() по таймауту обмена, а не зависает
+bool test_stalled_peer(int port)
+{
+    const pid_t pid = fork();
+
+    if (pid == 0)
+    {
+        try
+        {
+            TcpCommunicator comm(1, 2, port, "127.0.0.1", "127.0.0.1", 1);
+            std::this_thread::sleep_for(std::chrono::seconds(3));
+        }
+        catch (...) {}
+
+        _exit(0);
+    }
+
+    bool ok = false;
+
+    try
+    {
+        TcpCommunicator comm(0, 2, port, "127.0.0.1", "127.0.0.1", 1);
+        Network net;
+        build(net, 5);
+        net.set_communicator(&comm);
+        SGD opt(0.05);
+        const Matrix x = Matrix::Random(8, batch_size);
+        const Matrix y = x.topRows(2);
+        net.train_step(opt, x, y);
+    }
+    catch (const std::runtime_error& e)
+    {
+        std::cout << "stalled peer: " << e.what() << std::endl;
+        // Без таймаута обмен закончился бы только с выходом соседа через 3 секунды
+        ok = std::string(e.what()).find("Timed out") != std::string::npos;
+    }
+
+    waitpid(pid, NULL, 0);
+    return ok;
+}
+
+// Постороннее соединение с неверным приветствием отклоняется
+bool test_stray_connection(int port)
+{
+    const pid_t pid = fork();
+
+    if (pid == 0)
+    {
+        try
+        {
+            TcpCommunicator comm(1, 2, port, "127.0.0.1", "127.0.0.1", 10);
+            std::vector<Scalar> data(10, Scalar(2));
+            comm.allreduce(data.data(), data.size());
+            _exit(data[0] == Scalar(3) ? 0 : 1);
+        }
+        catch (...)
+        {
+            _exit(1);
+        }
+    }
+
+    // Подключаемся к процессу 1 раньше настоящего соседа и отправляем мусор
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port + 1);
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+    const int stray = socket(AF_INET, SOCK_STREAM, 0);
+
+    while (connect(stray, (sockaddr*)&addr, sizeof(addr)) != 0)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    const std::int32_t garbage[4] = {1, 0, 2, 4};
+    send(stray, garbage, sizeof(garbage), MSG_NOSIGNAL);
+    bool ok;
+
+    try
+    {
+        TcpCommunicator comm(0, 2, port, "127.0.0.1", "127.0.0.1", 10);
+        std::vector<Scalar> data(10, Scalar(1));
+        comm.allreduce(data.data(), data.size());
+        ok = data[0] == Scalar(3);
+    }
+    catch (const std::exception& e)
+    {
+        std::cout << "stray connection: " << e.what() << std::endl;
+        ok = false;
+    }
+
+    close(stray);
+    int status;
+    waitpid(pid, &status, 0);
+    ok = ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    std::cout << "stray connection rejected: " << ok << std::endl;
+    return ok;
+}
+
+int main()
+{
+    // Уникальные имя сегмента и порты для параллельных запусков
+    const std::string name = "/nne_test_" + std::to_string(getpid());
+    const int port = 20000 + getpid() % 20000;
+    bool ok = test_training(SHM, name, port);
+    ok = test_training(TCP, name, port) && ok;
+    ok = test_stale_segment(name, port) && ok;
+    ok = test_validation(name, port) && ok;
+    ok = test_dead_peer(name) && ok;
+    ok = test_missing_peer(port + 10) && ok;
+    ok = test_stray_connection(port + 20) && ok;
+    ok = test_stalled_peer(port + 30) && ok;
+    std::cout << (ok ? "OK" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
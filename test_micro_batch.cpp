@@ -0,0 +1,65 @@
+// Проверка накопления градиентов: fit() с set_micro_batch(k) должен давать те же
+// параметры, что и обучение полными пакетами с тем же начальным числом. Размер
+// пакета не кратен k, последний пакет эпохи неполный.
+//
+// g++ -std=c++17 -O2 -I. test_micro_batch.cpp -o test_micro_batch -pthread
+
+#include <iostream>
+#include "Network.h"
+#include "Layer/Dense.h"
+#include "Activation/ReLU.h"
+#include "Optimizer/SGD.h"
+#include "Output/Regression.h"
+
+using namespace NNE;
+typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+
+std::vector<Scalar> train(const Matrix& x, const Matrix& y, int batch_size, int micro_batch, Scalar& loss)
+{
+    Network net;
+    net.add_layer(new Dense<ReLU>(8, 32));
+    net.add_layer(new Dense<ReLU>(32, 2));
+    net.set_output(new RegressionMSE());
+    net.init(0, 0.3, 5);
+    net.set_micro_batch(micro_batch);
+    SGD opt(0.05);
+    net.fit(opt, x, y, batch_size, 4, 3);
+    loss = net.loss();
+
+    std::vector<Scalar> param(net.num_parameters());
+    net.copy_parameters(param.data());
+    return param;
+}
+
+int main()
+{
+    // 1030 наблюдений: при пакете 100 последний пакет содержит 30 наблюдений
+    const Matrix x = Matrix::Random(8, 1030);
+    const Matrix y = x.topRows(2).array().square().matrix();
+    const int batch_sizes[] = {100, 64};
+    const int micro_batches[] = {16, 7};
+    bool ok = true;
+
+    for (int batch_size : batch_sizes)
+    {
+        Scalar ref_loss;
+        const std::vector<Scalar> ref = train(x, y, batch_size, 0, ref_loss);
+
+        for (int micro_batch : micro_batches)
+        {
+            Scalar loss;
+            const std::vector<Scalar> param = train(x, y, batch_size, micro_batch, loss);
+            double diff = 0;
+
+            for (std::size_t i = 0; i < param.size(); i++)
+                diff = std::max<double>(diff, std::abs(param[i] - ref[i]));
+
+            std::cout << "batch " << batch_size << ", micro-batch " << micro_batch << ": param diff " << diff
+                      << ", loss " << loss << " (" << ref_loss << ")" << std::endl;
+            ok = ok && diff < 1e-4 && std::abs(loss - ref_loss) < 1e-4;
+        }
+    }
+
+    std::cout << (ok ? "OK" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
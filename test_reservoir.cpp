@@ -0,0 +1,129 @@
+// Проверка резервуара повторного использования:
+// - заполнение и замена по алгоритму R: пока резервуар не полон, сохраняются все
+//   наблюдения по порядку, затем каждое наблюдение потока остается в нем с
+//   вероятностью capacity / n;
+// - partial_fit() с повторением старых наблюдений сохраняет качество на раннем
+//   распределении данных лучше, чем без него.
+//
+// g++ -std=c++17 -O2 -I. test_reservoir.cpp -o test_reservoir -pthread
+
+#include <iostream>
+#include <cmath>
+#include "Network.h"
+#include "Layer/Dense.h"
+#include "Activation/ReLU.h"
+#include "Optimizer/SGD.h"
+#include "Output/Regression.h"
+
+using namespace NNE;
+typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+
+bool test_algorithm_r()
+{
+    const int capacity = 100, nstream = 1000, window = 50, ntrial = 400, ngroup = 10;
+    RNG rng(11);
+    // Номер наблюдения потока записан в его предикторах
+    Matrix x(1, nstream), y(1, nstream);
+
+    for (int j = 0; j < nstream; j++) x(0, j) = y(0, j) = Scalar(j);
+
+    // Заполнение: первые capacity наблюдений сохраняются подряд
+    ReplayReservoir fill(capacity, 1, 1);
+    fill.add(x.leftCols(60), y.leftCols(60), rng);
+    fill.add(x.middleCols(60, 40), y.middleCols(60, 40), rng);
+    bool ok = fill.size() == capacity && fill.stored_x() == x.leftCols(capacity) &&
+              fill.stored_y() == y.leftCols(capacity);
+
+    // Замена: доля сохраненных наблюдений каждой десятой части потока близка к capacity / nstream
+    std::vector<double> kept(ngroup, 0);
+
+    for (int t = 0; t < ntrial; t++)
+    {
+        ReplayReservoir res(capacity, 1, 1);
+
+        for (int b = 0; b < nstream; b += window)
+            res.add(x.middleCols(b, window), y.middleCols(b, window), rng);
+
+        ok = ok && res.size() == capacity && res.stored_x() == res.stored_y();
+
+        for (int j = 0; j < capacity; j++) kept[int(res.stored_x()(0, j)) * ngroup / nstream] += 1;
+    }
+
+    const double expected = double(capacity) / nstream;
+
+    for (int g = 0; g < ngroup; g++)
+    {
+        const double p = kept[g] / ntrial / (nstream / ngroup);
+        std::cout << "part " << g << ": kept " << p << " (expected " << expected << ")" << std::endl;
+        ok = ok && std::abs(p - expected) < 0.1 * expected;
+    }
+
+    return ok;
+}
+
+// Потеря на наборе (x, y)
+Scalar loss(Network& net, const Matrix& x, const Matrix& y)
+{
+    const Matrix pred = net.predict(x);
+    return (pred - y).squaredNorm() / x.cols() * Scalar(0.5);
+}
+
+// Поток окон сначала из области A, затем из области B; возвращает потери на A
+Scalar train_stream(const Matrix& xa, const Matrix& ya, const Matrix& xb, const Matrix& yb,
+                    const Matrix& xa_test, const Matrix& ya_test, int nreplay)
+{
+    const int window = 20;
+    Network net;
+    net.add_layer(new Dense<ReLU>(2, 32));
+    net.add_layer(new Dense<ReLU>(32, 1));
+    net.set_output(new RegressionMSE());
+    net.init(0, 0.3, 5);
+    SGD opt(0.02);
+    ReplayReservoir replay(400, 2, 1);
+
+    for (int epoch = 0; epoch < 5; epoch++)
+    {
+        for (int b = 0; b < xa.cols(); b += window)
+            net.partial_fit(opt, xa.middleCols(b, window), ya.middleCols(b, window), &replay, nreplay);
+    }
+
+    for (int epoch = 0; epoch < 5; epoch++)
+    {
+        for (int b = 0; b < xb.cols(); b += window)
+            net.partial_fit(opt, xb.middleCols(b, window), yb.middleCols(b, window), &replay, nreplay);
+    }
+
+    return loss(net, xa_test, ya_test);
+}
+
+bool test_replay()
+{
+    // Область A: первый предиктор около +2, область B: около -2; ответ - одна функция
+    auto region = [](int n, Scalar shift)
+    {
+        Matrix x = Matrix::Random(2, n);
+        x.row(0).array() += shift;
+        return x;
+    };
+    auto target = [](const Matrix& x)
+    {
+        Matrix y = (x.row(0).array() * Scalar(0.5)).sin().matrix() + x.row(1).array().square().matrix();
+        return y;
+    };
+    const Matrix xa = region(1000, 2), xb = region(1000, -2), xa_test = region(500, 2);
+    const Matrix ya = target(xa), yb = target(xb), ya_test = target(xa_test);
+
+    const Scalar loss_plain = train_stream(xa, ya, xb, yb, xa_test, ya_test, 0);
+    const Scalar loss_replay = train_stream(xa, ya, xb, yb, xa_test, ya_test, 20);
+    std::cout << "loss on earlier distribution: without replay " << loss_plain
+              << ", with replay " << loss_replay << std::endl;
+    return loss_replay < loss_plain;
+}
+
+int main()
+{
+    bool ok = test_algorithm_r();
+    ok = test_replay() && ok;
+    std::cout << (ok ? "OK" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,137 @@
+// Проверка точного продолжения обучения с контрольной точки при включенной
+// проверке и ранней остановке: обучение прерывается исключением из обратного
+// вызова, продолжается в новой сети и сравнивается с непрерывным обучением.
+// Проверяется и последовательное выполнение, и проверка задачей пула потоков.
+//
+// g++ -std=c++17 -O2 -I. test_resume.cpp -o test_resume -pthread
+
+#include <iostream>
+#include <cstdio>
+#include "Network.h"
+#include "Layer/Dense.h"
+#include "Activation/ReLU.h"
+#include "Optimizer/SGD.h"
+#include "Output/Regression.h"
+
+using namespace NNE;
+typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+
+// Прерывает обучение после заданного пакета
+class InterruptCallback : public Callback
+{
+public:
+    int epoch, batch;
+
+    InterruptCallback(int e, int b) : epoch(e), batch(b) {}
+
+    void post_training_batch(const Network* net, const Matrix& x, const Matrix& y) override
+    {
+        if (_epoch_id == epoch && _batch_id == batch) throw std::runtime_error("interrupted");
+    }
+};
+
+void build(Network& net)
+{
+    net.add_layer(new Dense<ReLU>(8, 32));
+    net.add_layer(new Dense<ReLU>(32, 2));
+    net.set_output(new RegressionMSE());
+    net.init(0, 0.3, 5);
+}
+
+struct Result
+{
+    std::vector<Scalar> param;
+    int                 best_epoch;
+    Scalar              best_loss;
+};
+
+Result finish(Network& net, const EarlyStopping& stopping)
+{
+    Result res;
+    res.param.resize(net.num_parameters());
+    net.copy_parameters(res.param.data());
+    res.best_epoch = stopping.best_epoch();
+    res.best_loss = stopping.best_loss();
+    return res;
+}
+
+bool check(ThreadPool* pool, const Matrix& x, const Matrix& y, const Matrix& x_val, const Matrix& y_val)
+{
+    const int nepoch = 12, batch_size = 100, seed = 3;
+    const std::string filename = "test_resume.ckpt";
+    bool ok = true;
+
+    // Непрерывное обучение
+    Result ref;
+    {
+        Network net;
+        build(net);
+        net.set_thread_pool(pool);
+        EarlyStopping stopping(2, Scalar(5e-3));
+        net.set_validation(x_val, y_val, &stopping);
+        SGD opt(0.03);
+        net.fit(opt, x, y, batch_size, nepoch, seed);
+        ref = finish(net, stopping);
+    }
+
+    // Период 7 дает точки внутри эпохи, период 10 - на последнем пакете эпохи
+    const int intervals[] = {7, 10};
+
+    for (int interval : intervals)
+    {
+        {
+            Network net;
+            build(net);
+            net.set_thread_pool(pool);
+            EarlyStopping stopping(2, Scalar(5e-3));
+            net.set_validation(x_val, y_val, &stopping);
+            Checkpointer checkpointer(filename, interval);
+            net.set_checkpointer(&checkpointer);
+            InterruptCallback callback(5, 5);
+            net.set_callback(callback);
+            SGD opt(0.03);
+
+            try
+            {
+                net.fit(opt, x, y, batch_size, nepoch, seed);
+            }
+            catch (const std::runtime_error&) {}
+        }
+
+        Checkpoint ckpt;
+        load_checkpoint(filename, ckpt);
+        Network net;
+        build(net);
+        net.set_thread_pool(pool);
+        EarlyStopping stopping(2, Scalar(5e-3));
+        net.set_validation(x_val, y_val, &stopping);
+        SGD opt(0.03);
+        net.resume(ckpt, opt);
+        net.fit(opt, x, y, batch_size, nepoch, seed);
+        const Result res = finish(net, stopping);
+        double diff = 0;
+
+        for (std::size_t i = 0; i < res.param.size(); i++)
+            diff = std::max<double>(diff, std::abs(res.param[i] - ref.param[i]));
+
+        std::cout << (pool ? "pool" : "serial") << ", interval " << interval << ": checkpoint epoch " << ckpt.epoch << " batch " << ckpt.batch
+                  << ", best epoch " << res.best_epoch << " (" << ref.best_epoch << ")"
+                  << ", param diff " << diff << std::endl;
+        ok = ok && diff == 0 && res.best_epoch == ref.best_epoch && res.best_loss == ref.best_loss;
+    }
+
+    std::remove(filename.c_str());
+    return ok;
+}
+
+int main()
+{
+    const Matrix x = Matrix::Random(8, 1000);
+    const Matrix y = x.topRows(2).array().square().matrix();
+    const Matrix x_val = Matrix::Random(8, 300);
+    const Matrix y_val = x_val.topRows(2).array().square().matrix();
+    ThreadPool pool(2);
+    const bool ok = check(NULL, x, y, x_val, y_val) && check(&pool, x, y, x_val, y_val);
+    std::cout << (ok ? "OK" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}
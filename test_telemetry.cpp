@@ -0,0 +1,186 @@
+// Проверка канала телеметрии:
+// - кольцевой буфер передает записи от производителя потребителю по порядку и без потерь;
+// - обучение с обратным вызовом по умолчанию пишет в CSV и JSON Lines сводку,
+//   совпадающую с пакетами обучения;
+// - при переполнении буфера записи отбрасываются, а счетчик потерь попадает в сводку.
+//
+// g++ -std=c++17 -O2 -I. test_telemetry.cpp -o test_telemetry -pthread
+
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <cstdio>
+#include "Network.h"
+#include "Layer/Dense.h"
+#include "Activation/ReLU.h"
+#include "Optimizer/SGD.h"
+#include "Output/Regression.h"
+
+using namespace NNE;
+typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+
+// Сохраняет сводки в памяти
+class MemorySink : public TelemetrySink
+{
+public:
+    std::vector<TelemetrySummary> summaries;
+
+    void write(const TelemetrySummary& s) override { summaries.push_back(s);}
+};
+
+bool test_ring()
+{
+    const long n = 200000;
+    internal::RingBuffer<long> ring(64);
+    std::thread producer([&ring, n]()
+    {
+        for (long i = 0; i < n; i++)
+        {
+            while (!ring.push(i)) std::this_thread::yield();
+        }
+    });
+
+    long expected = 0, item;
+    bool ok = true;
+
+    while (expected < n)
+    {
+        if (!ring.pop(item))
+        {
+            std::this_thread::yield();
+            continue;
+        }
+
+        ok = ok && item == expected;
+        expected++;
+    }
+
+    producer.join();
+    ok = ok && !ring.pop(item);
+    std::cout << "ring: " << n << " records in order " << ok << std::endl;
+    return ok;
+}
+
+// Обучение с обратным вызовом по умолчанию; сводка выводится один раз при удалении канала
+Scalar train(TelemetrySink& sink)
+{
+    const Matrix x = Matrix::Random(8, 1030);
+    const Matrix y = x.topRows(2).array().square().matrix();
+    Network net;
+    net.add_layer(new Dense<ReLU>(8, 16));
+    net.add_layer(new Dense<ReLU>(16, 2));
+    net.set_output(new RegressionMSE());
+    net.init(0, 0.1, 42);
+    SGD opt(0.05);
+    {
+        Telemetry telemetry(sink, 1000.0);
+        Callback callback(&telemetry);
+        net.set_callback(callback);
+        net.fit(opt, x, y, 100, 3, 1);
+        net.set_default_callback();
+    }
+    return net.loss();
+}
+
+// Значение поля `key` в строке JSON Lines
+double json_field(const std::string& line, const std::string& key)
+{
+    const std::size_t pos = line.find("\"" + key + "\":");
+    return (pos == std::string::npos) ? -1 : std::stod(line.substr(pos + key.size() + 3));
+}
+
+bool test_sinks()
+{
+    // 1030 наблюдений по 100: 11 пакетов в эпохе, 3 эпохи
+    const int nbatch = 33;
+    const std::string csv_file = "test_telemetry.csv", json_file = "test_telemetry.jsonl";
+    bool ok = true;
+    Scalar loss;
+
+    {
+        CsvSink sink(csv_file);
+        loss = train(sink);
+    }
+
+    std::ifstream csv(csv_file.c_str());
+    std::string header, row, extra;
+    std::getline(csv, header);
+    std::getline(csv, row);
+    ok = ok && header == "epoch,batch,nbatch,last_loss,mean_loss,batch_time,throughput,dropped" &&
+         !std::getline(csv, extra);
+    std::vector<double> field;
+    std::stringstream ss(row);
+    std::string cell;
+
+    while (std::getline(ss, cell, ',')) field.push_back(std::stod(cell));
+
+    ok = ok && field.size() == 8 && field[0] == 2 && field[1] == 10 && field[2] == nbatch &&
+         std::abs(field[3] - loss) < 1e-5 * (1 + loss) && field[5] > 0 && field[6] > 0 && field[7] == 0;
+    std::cout << "csv: " << row << std::endl;
+
+    {
+        JsonLinesSink sink(json_file);
+        loss = train(sink);
+    }
+
+    std::ifstream json(json_file.c_str());
+    std::string line;
+    std::getline(json, line);
+    ok = ok && !std::getline(json, extra) && line.front() == '{' && line.back() == '}' &&
+         json_field(line, "epoch") == 2 && json_field(line, "batch") == 10 &&
+         json_field(line, "nbatch") == nbatch &&
+         std::abs(json_field(line, "last_loss") - loss) < 1e-5 * (1 + loss) &&
+         json_field(line, "throughput") > 0 && json_field(line, "dropped") == 0;
+    std::cout << "jsonl: " << line << std::endl;
+
+    std::ostringstream os;
+    ConsoleSink console(os);
+    TelemetrySummary s = TelemetrySummary();
+    s.epoch = 1;
+    s.batch = 2;
+    s.dropped = 3;
+    console.write(s);
+    ok = ok && os.str().find("[Epoch 1, batch 2]") == 0 && os.str().find("dropped 3") != std::string::npos;
+
+    std::remove(csv_file.c_str());
+    std::remove(json_file.c_str());
+    return ok;
+}
+
+bool test_drop()
+{
+    MemorySink sink;
+    int accepted = 0;
+    long dropped;
+    {
+        // Фоновый поток не выводит сводку до удаления канала, поэтому буфер
+        // на 8 записей переполняется
+        Telemetry telemetry(sink, 1000.0, 8);
+        TelemetryRecord rec = TelemetryRecord();
+
+        for (int i = 0; i < 20; i++)
+        {
+            rec.batch = i;
+            rec.nobs = 10;
+            rec.batch_time = 0.5;
+            accepted += telemetry.push(rec);
+        }
+
+        dropped = telemetry.dropped();
+    }
+
+    const bool ok = accepted == 8 && dropped == 12 && sink.summaries.size() == 1 &&
+                    sink.summaries[0].nbatch == 8 && sink.summaries[0].batch == 7 &&
+                    sink.summaries[0].dropped == 12 && sink.summaries[0].throughput == 20;
+    std::cout << "drop: accepted " << accepted << ", dropped " << dropped << std::endl;
+    return ok;
+}
+
+int main()
+{
+    bool ok = test_ring();
+    ok = test_sinks() && ok;
+    ok = test_drop() && ok;
+    std::cout << (ok ? "OK" : "FAILED") << std::endl;
+    return ok ? 0 : 1;
+}